@@ -0,0 +1,48 @@
+#include "SyntheticData.h"
+#include "DecayFunction.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/normal_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <algorithm>
+#include <cmath>
+
+SyntheticProblem generate_problem(const SyntheticConfig& config)
+{
+    boost::random::mt19937 rng(config.seed);
+    boost::random::normal_distribution<double> normal;
+    boost::random::uniform_real_distribution<double> uniform;
+
+    const std::size_t n = config.num_customers;
+    const std::size_t d = config.dimension;
+    const std::size_t k = std::max<std::size_t>(config.num_clusters, 1);
+
+    SyntheticProblem p;
+    Eigen::MatrixXd means(k, d);
+    for (std::size_t c = 0; c < k; ++c)
+        for (std::size_t j = 0; j < d; ++j)
+            means(c, j) = config.separation * normal(rng);
+
+    p.coordinates.resize(n, 2);
+    p.data.resize(n, d);
+    p.labels.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        p.coordinates(i, 0) = uniform(rng);
+        p.coordinates(i, 1) = uniform(rng);
+        p.labels[i] = std::min(k - 1, static_cast<std::size_t>(p.coordinates(i, 0) * k));
+        for (std::size_t j = 0; j < d; ++j)
+            p.data(i, j) = means(p.labels[i], j) + normal(rng);
+    }
+
+    // expected number of other customers within distance r is about pi r^2 n
+    const double r = std::sqrt( config.num_neighbors / (M_PI * static_cast<double>(n)) );
+    WindowedExponentialDecay decay(r, r);
+    p.log_decay = std::make_shared<const SparseLogDecay>(
+                compute_log_decay(DataMatrix::view_of(p.coordinates), decay, config.self_log_decay) );
+
+    p.k0 = 0.01;
+    p.v0 = static_cast<double>(d) + 3.0;
+    p.mu0 = Eigen::VectorXd::Zero(d);
+    p.S0 = (p.v0 - static_cast<double>(d) - 1.0) * Eigen::MatrixXd::Identity(d, d);
+    return p;
+}
@@ -0,0 +1,45 @@
+#ifndef SYNTHETICDATA_H
+#define SYNTHETICDATA_H
+#include "SparseLogDecay.h"
+#include <eigen3/Eigen/Core>
+#include <memory>
+#include <vector>
+
+// Gaussian mixture workload for benchmarks. Customers are placed uniformly in
+// the unit square and belong to one of num_clusters vertical strips; each
+// cluster has a mean drawn from N(0, separation^2 I) and unit covariance. The
+// log decay is a windowed exponential of the distance in the square, with the
+// window chosen so that each customer has about num_neighbors possible links.
+struct SyntheticConfig
+{
+    SyntheticConfig()
+        : num_customers(1000), dimension(2), num_clusters(5), num_neighbors(20),
+          separation(4.0), self_log_decay(0.0), seed(1)
+    {}
+
+    std::size_t num_customers;
+    std::size_t dimension;
+    std::size_t num_clusters;
+    double num_neighbors;
+    double separation;
+    double self_log_decay;
+    unsigned int seed;
+};
+
+struct SyntheticProblem
+{
+    Eigen::MatrixXd data; // num_customers by dimension
+    Eigen::MatrixXd coordinates; // num_customers by 2
+    std::vector<std::size_t> labels; // true cluster of each customer
+    std::shared_ptr<const SparseLogDecay> log_decay;
+
+    // normal-inverse-Wishart prior with expected cluster covariance I
+    Eigen::VectorXd mu0;
+    Eigen::MatrixXd S0;
+    double k0;
+    double v0;
+};
+
+SyntheticProblem generate_problem(const SyntheticConfig& config);
+
+#endif
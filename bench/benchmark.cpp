@@ -0,0 +1,315 @@
+#include "SyntheticData.h"
+#include "CustomerAssignment.h"
+#include "MultivariateNormal.h"
+#include "FixedDimensionNormal.h"
+#include "ddCRP.h"
+#include <boost/program_options.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int_distribution.hpp>
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <sstream>
+#include <vector>
+
+// Benchmark of the sampler on synthetic Gaussian mixture data. Prints one JSON
+// object with per-sweep wall time, per-customer update latency percentiles,
+// likelihood cache hit rate, link/unlink latencies, likelihood scoring times
+// and peak resident set size. With --sweep-threads, also the time of parallel
+// sweeps from the same state, their mean batch size and the speed-up.
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsed_ns(const Clock::time_point& start, const Clock::time_point& end)
+{
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// percentile by the nearest-rank method
+double percentile(std::vector<double>& sorted, double q)
+{
+    if (sorted.empty())
+        return 0.0;
+    const std::size_t rank = static_cast<std::size_t>( std::ceil(q * sorted.size()) );
+    return sorted[ std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0) ];
+}
+
+std::string latency_json(std::vector<double> ns)
+{
+    std::sort(ns.begin(), ns.end());
+    const double mean = ns.empty() ? 0.0 : std::accumulate(ns.begin(), ns.end(), 0.0) / ns.size();
+    std::stringstream st;
+    st << "{\"count\": " << ns.size()
+       << ", \"mean\": " << mean
+       << ", \"p50\": " << percentile(ns, 0.5)
+       << ", \"p90\": " << percentile(ns, 0.9)
+       << ", \"p99\": " << percentile(ns, 0.99)
+       << ", \"max\": " << (ns.empty() ? 0.0 : ns.back()) << "}";
+    return st.str();
+}
+
+// uncached scoring times of tables of several sizes, and of merging a single
+// customer into them (the common case within a sweep)
+std::string scoring_json(LikelihoodFcn& scorer, const SyntheticProblem& problem, std::size_t num_score_calls)
+{
+    const std::size_t n = problem.data.rows();
+    const std::size_t dimension = problem.data.cols();
+    scorer.set_cache_capacity(0);
+    std::stringstream marginal_json, merge_json;
+    std::vector<std::size_t> customers(n);
+    std::iota(customers.begin(), customers.end(), 0);
+    bool first = true;
+    for (std::size_t size = 1; size <= n; size *= 10)
+    {
+        std::vector<std::size_t> members(customers.begin(), customers.begin() + size);
+        SufficientStatistics table(dimension, scorer.get_scatter_offset());
+        for (std::size_t c : members)
+            table.add(c, problem.data.row(c));
+        const std::size_t other = (size < n) ? size : 0;
+        SufficientStatistics single(dimension, scorer.get_scatter_offset());
+        single.add(other, problem.data.row(other));
+        const std::vector<std::size_t> single_members(1, other);
+
+        double sink = 0.0;
+        Clock::time_point start = Clock::now();
+        for (std::size_t r = 0; r < num_score_calls; ++r)
+            sink += scorer.get_marginal_log_likelihood(table);
+        Clock::time_point mid = Clock::now();
+        for (std::size_t r = 0; r < num_score_calls; ++r)
+            sink += scorer.get_merged_marginal_log_likelihood(table, single, single_members);
+        Clock::time_point end = Clock::now();
+        if (sink == 1.0) // keep the calls from being optimized away
+            std::cerr << "";
+
+        marginal_json << (first ? "" : ", ") << "\"" << size << "\": " << elapsed_ns(start, mid) / num_score_calls;
+        merge_json << (first ? "" : ", ") << "\"" << size << "\": " << elapsed_ns(mid, end) / num_score_calls;
+        first = false;
+    }
+
+    // merging a single customer into each of many tables of ten customers with one
+    // call, as in a customer update
+    const std::size_t num_batch_tables = std::max<std::size_t>(1, std::min<std::size_t>(64, n / 10));
+    std::vector<SufficientStatistics> batch_tables;
+    std::vector<const SufficientStatistics*> batch;
+    for (std::size_t t = 0; t < num_batch_tables; ++t)
+    {
+        batch_tables.push_back( SufficientStatistics(dimension, scorer.get_scatter_offset()) );
+        for (std::size_t c = 10 * t; c < std::min(n, 10 * t + 10); ++c)
+            batch_tables.back().add(c, problem.data.row(c));
+    }
+    for (const auto& t : batch_tables)
+        batch.push_back(&t);
+    SufficientStatistics single(dimension, scorer.get_scatter_offset());
+    single.add(n - 1, problem.data.row(n - 1));
+    const std::vector<std::size_t> single_members(1, n - 1);
+    std::vector<double> ratios;
+    const std::size_t num_batch_calls = std::max<std::size_t>(1, num_score_calls / num_batch_tables);
+    Clock::time_point start = Clock::now();
+    for (std::size_t r = 0; r < num_batch_calls; ++r)
+        scorer.get_merge_log_likelihood_ratios(single, single_members, batch, ratios);
+    const double batch_ns = elapsed_ns(start, Clock::now()) / (num_batch_calls * num_batch_tables);
+
+    std::stringstream json;
+    json << "{\"marginal_ns_by_table_size\": {" << marginal_json.str()
+         << "}, \"merge_one_ns_by_table_size\": {" << merge_json.str()
+         << "}, \"merge_batch_ns_per_table\": " << batch_ns << "}";
+    return json.str();
+}
+
+long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss; // kilobytes on Linux
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    SyntheticConfig config;
+    std::size_t warmup_sweeps, sweeps, num_link_ops, num_score_calls, num_sweep_threads;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+            ("help", "produce help message")
+            ("customers,N", po::value<std::size_t>(&config.num_customers)->default_value(config.num_customers), "number of customers")
+            ("dimension,d", po::value<std::size_t>(&config.dimension)->default_value(config.dimension), "feature dimension")
+            ("clusters,K", po::value<std::size_t>(&config.num_clusters)->default_value(config.num_clusters), "number of mixture components")
+            ("neighbors", po::value<double>(&config.num_neighbors)->default_value(config.num_neighbors), "expected number of possible links per customer")
+            ("separation", po::value<double>(&config.separation)->default_value(config.separation), "standard deviation of the component means")
+            ("self-log-decay", po::value<double>(&config.self_log_decay)->default_value(config.self_log_decay), "log decay of self links")
+            ("seed,s", po::value<unsigned int>(&config.seed)->default_value(config.seed), "RNG seed of data generation and sampling")
+            ("warmup", po::value<std::size_t>(&warmup_sweeps)->default_value(2), "sweeps before measuring")
+            ("sweeps", po::value<std::size_t>(&sweeps)->default_value(5), "measured sweeps")
+            ("sweep-threads", po::value<std::size_t>(&num_sweep_threads)->default_value(1), "also measure parallel sweeps on this many threads (1: only serial sweeps)")
+            ("link-ops", po::value<std::size_t>(&num_link_ops)->default_value(100000), "measured link and unlink operations")
+            ("score-calls", po::value<std::size_t>(&num_score_calls)->default_value(2000), "measured likelihood evaluations per table size")
+            ("dynamic-dimension", po::bool_switch()->default_value(false), "sample with MultivariateNormal also for 2 to 8 dimensional features")
+            ("output,o", po::value<std::string>(), "write the JSON result to this file instead of standard output")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help"))
+    {
+        std::cout << desc << "\n";
+        return 1;
+    }
+
+    Clock::time_point t0 = Clock::now();
+    const SyntheticProblem problem = generate_problem(config);
+    const double generate_s = elapsed_ns(t0, Clock::now()) * 1e-9;
+    const std::size_t n = config.num_customers;
+    const SparseLogDecay& log_decay = *problem.log_decay;
+    std::shared_ptr<const Eigen::MatrixXd> data = std::make_shared<const Eigen::MatrixXd>(problem.data);
+
+    // sweeps of ddCRP::iterate, timing each customer update
+    std::shared_ptr<LikelihoodFcn> likelihood =
+            make_normal_likelihood(data, problem.mu0, problem.S0, problem.k0, problem.v0, !vm["dynamic-dimension"].as<bool>());
+    ddCRP sampler(problem.log_decay, config.seed);
+    sampler.setLikelihood(likelihood);
+    for (std::size_t s = 0; s < warmup_sweeps; ++s)
+        sampler.iterate();
+
+    const LikelihoodCache::Statistics cache_before = likelihood->get_cache_statistics();
+    std::vector<double> sweep_s;
+    std::vector<double> update_ns;
+    update_ns.reserve(sweeps * n);
+    for (std::size_t s = 0; s < sweeps; ++s)
+    {
+        const Clock::time_point sweep_start = Clock::now();
+        Clock::time_point start = sweep_start;
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            sampler.update(i);
+            const Clock::time_point end = Clock::now();
+            update_ns.push_back( elapsed_ns(start, end) );
+            start = end;
+        }
+        sweep_s.push_back( elapsed_ns(sweep_start, start) * 1e-9 );
+    }
+    const LikelihoodCache::Statistics cache_after = likelihood->get_cache_statistics();
+    const double hits = static_cast<double>(cache_after.hits_ - cache_before.hits_);
+    const double misses = static_cast<double>(cache_after.misses_ - cache_before.misses_);
+
+    // parallel sweeps of a second chain, from the state after the same warm-up
+    std::vector<double> parallel_sweep_s;
+    std::uint64_t parallel_updates = 0, parallel_batches = 0;
+    std::size_t parallel_tables = 0;
+    if (num_sweep_threads > 1)
+    {
+        std::shared_ptr<LikelihoodFcn> parallel_likelihood =
+                make_normal_likelihood(data, problem.mu0, problem.S0, problem.k0, problem.v0, !vm["dynamic-dimension"].as<bool>());
+        ddCRP parallel(problem.log_decay, config.seed);
+        parallel.setLikelihood(parallel_likelihood);
+        for (std::size_t s = 0; s < warmup_sweeps; ++s)
+            parallel.iterate();
+        parallel.set_sweep_thread_pool( std::make_shared<ThreadPool>(num_sweep_threads) );
+        for (std::size_t s = 0; s < sweeps; ++s)
+        {
+            parallel.iterate();
+            const SweepMetrics& m = parallel.get_metrics();
+            parallel_sweep_s.push_back(m.sweep_seconds_);
+            parallel_updates += m.customer_updates_;
+            parallel_batches += m.batches_;
+        }
+        parallel_tables = parallel.num_tables();
+    }
+
+    // CustomerAssignment::link and unlink with statistics tracking, starting from random links
+    boost::random::mt19937 rng(config.seed);
+    CustomerAssignment assignment(n);
+    const DataView view = DataMatrix::view_of(*data);
+    assignment.track_statistics(view, likelihood->get_scatter_offset());
+    auto random_target = [&](std::size_t source)
+    {
+        boost::random::uniform_int_distribution<std::size_t> pick(log_decay.row_begin(source), log_decay.row_end(source) - 1);
+        return log_decay.target( pick(rng) );
+    };
+    for (std::size_t i = 0; i < n; ++i)
+        assignment.link(i, random_target(i));
+
+    std::vector<double> unlink_ns, link_ns;
+    unlink_ns.reserve(num_link_ops);
+    link_ns.reserve(num_link_ops);
+    boost::random::uniform_int_distribution<std::size_t> pick_customer(0, n - 1);
+    for (std::size_t op = 0; op < num_link_ops; ++op)
+    {
+        const std::size_t source = pick_customer(rng);
+        const std::size_t target = random_target(source);
+        Clock::time_point start = Clock::now();
+        assignment.unlink(source);
+        Clock::time_point mid = Clock::now();
+        assignment.link(source, target);
+        Clock::time_point end = Clock::now();
+        unlink_ns.push_back( elapsed_ns(start, mid) );
+        link_ns.push_back( elapsed_ns(mid, end) );
+    }
+
+    // scoring with the generic likelihood and, if there is one, with the fixed-dimension one
+    MultivariateNormal scorer(data, problem.mu0, problem.S0, problem.k0, problem.v0);
+    const std::string scoring = scoring_json(scorer, problem, num_score_calls);
+    std::string fixed_scoring;
+    std::shared_ptr<LikelihoodFcn> fixed_scorer = make_normal_likelihood(data, problem.mu0, problem.S0, problem.k0, problem.v0);
+    if ( !std::dynamic_pointer_cast<MultivariateNormal>(fixed_scorer) )
+        fixed_scoring = scoring_json(*fixed_scorer, problem, num_score_calls);
+
+    std::stringstream sweeps_json;
+    for (std::size_t s = 0; s < sweep_s.size(); ++s)
+        sweeps_json << (s > 0 ? ", " : "") << sweep_s[s];
+    const double mean_sweep_s = sweep_s.empty() ? 0.0 : std::accumulate(sweep_s.begin(), sweep_s.end(), 0.0) / sweep_s.size();
+    std::stringstream parallel_json;
+    if (num_sweep_threads > 1)
+    {
+        std::stringstream parallel_sweeps_json;
+        for (std::size_t s = 0; s < parallel_sweep_s.size(); ++s)
+            parallel_sweeps_json << (s > 0 ? ", " : "") << parallel_sweep_s[s];
+        const double mean_parallel_s = parallel_sweep_s.empty() ? 0.0 :
+                std::accumulate(parallel_sweep_s.begin(), parallel_sweep_s.end(), 0.0) / parallel_sweep_s.size();
+        parallel_json << "  \"parallel_sweep\": {\"threads\": " << num_sweep_threads
+                      << ", \"sweep_seconds\": [" << parallel_sweeps_json.str() << "], \"mean_sweep_seconds\": " << mean_parallel_s
+                      << ", \"mean_batch_size\": " << ((parallel_batches > 0) ? static_cast<double>(parallel_updates) / parallel_batches : 0.0)
+                      << ", \"speed_up\": " << ((mean_parallel_s > 0.0) ? mean_sweep_s / mean_parallel_s : 0.0)
+                      << ", \"num_tables\": " << parallel_tables << "},\n";
+    }
+
+    std::stringstream json;
+    json << "{\n"
+         << "  \"config\": {\"customers\": " << n << ", \"dimension\": " << config.dimension
+         << ", \"clusters\": " << config.num_clusters << ", \"neighbors\": " << config.num_neighbors
+         << ", \"possible_links\": " << log_decay.num_links() << ", \"separation\": " << config.separation
+         << ", \"self_log_decay\": " << config.self_log_decay << ", \"seed\": " << config.seed
+         << ", \"warmup_sweeps\": " << warmup_sweeps << ", \"sweeps\": " << sweeps << "},\n"
+         << "  \"generate_seconds\": " << generate_s << ",\n"
+         << "  \"iterate\": {\"sweep_seconds\": [" << sweeps_json.str() << "], \"mean_sweep_seconds\": " << mean_sweep_s
+         << ", \"customer_update_ns\": " << latency_json(update_ns)
+         << ", \"num_tables\": " << sampler.num_tables()
+         << ", \"cache_hits\": " << hits << ", \"cache_misses\": " << misses
+         << ", \"cache_hit_rate\": " << ((hits + misses > 0) ? hits / (hits + misses) : 0.0) << "},\n"
+         << parallel_json.str()
+         << "  \"customer_assignment\": {\"unlink_ns\": " << latency_json(unlink_ns)
+         << ", \"link_ns\": " << latency_json(link_ns) << "},\n"
+         << "  \"multivariate_normal\": " << scoring << ",\n";
+    if ( !fixed_scoring.empty() )
+        json << "  \"fixed_dimension_normal\": " << fixed_scoring << ",\n";
+    json << "  \"peak_rss_kb\": " << peak_rss_kb() << "\n"
+         << "}\n";
+
+    if (vm.count("output"))
+    {
+        std::ofstream out(vm["output"].as<std::string>());
+        out << json.str();
+    }
+    else
+        std::cout << json.str();
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef CONVERGENCEDIAGNOSTICS_H
+#define CONVERGENCEDIAGNOSTICS_H
+#include <cstddef>
+#include <vector>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Between-chain diagnostics of a scalar quantity traced in several chains:
+// split R-hat and effective sample size as in Gelman et al., Bayesian Data Analysis,
+// 3rd ed., Sect. 11.4-11.5. Only the first num_draws() draws of each chain are used.
+class ConvergenceDiagnostics
+{
+public:
+    ConvergenceDiagnostics(std::size_t num_chains);
+
+    void add(std::size_t chain, double value);
+    void clear();
+    // binary snapshot of the draws; loading requires the same number of chains
+    void save(SnapshotWriter& snapshot) const;
+    void load(SnapshotReader& snapshot);
+
+    std::size_t num_chains() const;
+    std::size_t num_draws() const; // smallest number of draws in any chain
+    const std::vector<double>& get_draws(std::size_t chain) const;
+
+    // NaN while there are too few draws (fewer than four per chain)
+    double r_hat() const;
+    double effective_sample_size() const;
+
+private:
+    // each chain split in halves, and their means and variances
+    void split_chains(std::vector< std::vector<double> >& halves,
+                      std::vector<double>& means,
+                      std::vector<double>& variances) const;
+
+    std::vector< std::vector<double> > draws_;
+};
+
+#endif
@@ -1,9 +1,15 @@
 #ifndef CUSTOMERASSIGNMENT_H
 #define CUSTOMERASSIGNMENT_H
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/filtered_graph.hpp>
-#include <boost/function.hpp>
+#include "SufficientStatistics.h"
+#include "DataMatrix.h"
+#include <iostream>
+#include <memory>
+#include <set>
+#include <vector>
 
+// Links between customers and the tables (connected components) they induce.
+// Each customer has one outgoing link; tables are numbered 0 ... num_tables()-1,
+// and the numbering may change whenever links change.
 class CustomerAssignment
 {
 public:
@@ -11,6 +17,12 @@ public:
     void print_tables(std::ostream &os) const;
     void unlink(std::size_t source);
     void link(std::size_t source, std::size_t target);
+    // replace all links at once, finding the tables in one union-find pass
+    // instead of linking one customer at a time; tables are numbered in order
+    // of their smallest member. Every link must be a customer index.
+    void assign(const std::vector<std::size_t>& links);
+    // root of i in a union-find forest given by parent links, halving the path on the way
+    static std::size_t find_root(std::vector<std::size_t>& parent, std::size_t i);
     bool joins_tables(std::size_t source,
                       std::size_t target,
                       std::size_t& k,
@@ -19,26 +31,63 @@ public:
     std::size_t num_customers() const;
     std::size_t num_tables() const;
     std::size_t get_table(std::size_t customer) const;
+    std::size_t get_link(std::size_t customer) const;
     std::set<std::size_t> get_table_members(std::size_t table) const;
+    // members of a table in no particular order
+    const std::vector<std::size_t>& table_members(std::size_t table) const;
+    // label of each customer's table that does not depend on the table numbering:
+    // the smallest member of the table
+    void get_labels(std::vector<std::size_t>& labels) const;
+    // the same written to labels[0] ... labels[num_customers()-1]
+    void get_labels(std::size_t* labels) const;
+
+    // keep per-table sufficient statistics of the given data up to date,
+    // including Cholesky factors if an offset is given, or only the diagonal
+    // of the scatter matrices. The data must outlive this object.
+    void track_statistics(const DataView& data,
+                          const std::shared_ptr<const ScatterOffset>& offset = std::shared_ptr<const ScatterOffset>(),
+                          bool diagonal = false);
+    const SufficientStatistics& get_table_statistics(std::size_t table) const;
+
+    // Binary snapshot of the links, the table numbering and member order, and
+    // the tracked statistics, so that a loaded assignment evolves exactly like
+    // the saved one. Loading requires the same number of customers and the same
+    // statistics tracking, and throws std::runtime_error otherwise.
+    void save(SnapshotWriter& snapshot) const;
+    void load(SnapshotReader& snapshot);
 
 
 private:
-    typedef boost::adjacency_list<
-    boost::listS,
-    boost::vecS,
-    boost::undirectedS
-    > UndirectedGraph;
+    bool connected(std::size_t a, std::size_t b, std::vector<std::size_t>& smaller);
+    bool expand(std::size_t customer, std::size_t own, std::size_t other, std::vector<std::size_t>& queue);
+    void split_table(std::size_t table, const std::vector<std::size_t>& leaving);
+    void merge_tables(std::size_t k, std::size_t l);
+    void remove_table(std::size_t table);
+    SufficientStatistics compute_statistics(const std::vector<std::size_t>& customers) const;
+
+    std::vector<std::size_t> links_; // outgoing link of each customer
+    std::vector< std::vector<std::size_t> > incoming_; // customers linking to each customer, except self links
 
-    typedef typename boost::graph_traits<UndirectedGraph>::vertex_descriptor Vertex;
-    typedef typename boost::graph_traits<UndirectedGraph>::edge_descriptor Edge;
-    typedef boost::filtered_graph<UndirectedGraph, boost::function<bool(Edge)>, boost::function<bool(Vertex)> > ComponentGraph;
+    // Tables are stored in slots that never change while a table exists, so that
+    // removing a table only renumbers the table in the last position, not its members.
+    std::vector<std::size_t> slot_; // slot of the table of each customer
+    std::vector<std::size_t> slot_table_; // table number of each slot in use
+    std::vector<std::size_t> free_slots_;
+    std::vector<std::size_t> table_slot_; // slot of each table
 
-    bool is_in_table(std::size_t customer, std::size_t table) const;
+    std::vector< std::vector<std::size_t> > members_; // customers at each table
+    std::vector<std::size_t> position_; // index of each customer in its table's member list
 
+    const DataView* data_; // data for statistics tracking, or NULL
+    std::shared_ptr<const ScatterOffset> offset_;
+    bool diagonal_;
+    std::vector<SufficientStatistics> stats_; // statistics of each table
 
-    UndirectedGraph g_; // links from customer to customer
-    std::vector<std::size_t> tables_; // which table each customer sits at
-    std::size_t n_tables_; // how many tables are there
+    // scratch space for connectivity searches
+    std::vector<std::size_t> visited_;
+    std::size_t visit_stamp_;
+    std::vector<std::size_t> queue_a_;
+    std::vector<std::size_t> queue_b_;
 };
 
 #endif
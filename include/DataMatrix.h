@@ -0,0 +1,34 @@
+#ifndef DATAMATRIX_H
+#define DATAMATRIX_H
+#include <eigen3/Eigen/Core>
+#include <memory>
+
+// Read-only view of a data matrix. The strides let the same type view both
+// column-major and row-major storage in place.
+typedef Eigen::Map<const Eigen::MatrixXd, 0, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> > DataView;
+
+// A data matrix viewed in place, together with whatever keeps its memory alive
+// (a shared matrix, a memory-mapped file, ...).
+struct DataMatrix
+{
+    // copies the matrix
+    DataMatrix(const Eigen::MatrixXd& data);
+    // shares the matrix
+    DataMatrix(const std::shared_ptr<const Eigen::MatrixXd>& data);
+    // views memory kept alive by owner. With a NULL owner the memory belongs to the
+    // caller, who keeps it alive and unchanged while any copy of this object, or a
+    // likelihood or sampler using it, exists.
+    DataMatrix(const DataView& view, const std::shared_ptr<const void>& owner);
+    DataMatrix(const DataMatrix& other);
+    // re-points the view instead of assigning the viewed values
+    DataMatrix& operator=(const DataMatrix& other);
+
+    static DataView view_of(const Eigen::MatrixXd& m);
+    // view of a rows-by-cols array stored row by row (one data point after the other) or column by column
+    static DataView view_of(const double* data, Eigen::Index rows, Eigen::Index cols, bool row_major);
+
+    DataView view_;
+    std::shared_ptr<const void> owner_;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef DECAYFUNCTION_H
+#define DECAYFUNCTION_H
+#include "DataMatrix.h"
+#include "SparseLogDecay.h"
+#include <memory>
+#include <string>
+
+// Decay function f of the distance between two customers. Links beyond
+// max_distance() are impossible, which keeps the log decay values sparse.
+class DecayFunction
+{
+public:
+    virtual ~DecayFunction() {}
+    // log f(d) for 0 <= d <= max_distance()
+    virtual double log_decay(double d) const = 0;
+    virtual double max_distance() const = 0;
+
+    // "exponential", "logistic" or "window" with parameter a and cutoff distance d_max;
+    // throws std::invalid_argument for other names
+    static std::shared_ptr<const DecayFunction> create(const std::string& name, double a, double d_max);
+};
+
+// f(d) = exp(-d/a) if d <= d_max, 0 otherwise
+class WindowedExponentialDecay : public DecayFunction
+{
+public:
+    WindowedExponentialDecay(double a, double d_max);
+    virtual double log_decay(double d) const;
+    virtual double max_distance() const;
+
+private:
+    double a_;
+    double d_max_;
+};
+
+// f(d) = exp(a-d) / (1 + exp(a-d)) if d <= d_max, 0 otherwise
+class LogisticDecay : public DecayFunction
+{
+public:
+    LogisticDecay(double a, double d_max);
+    virtual double log_decay(double d) const;
+    virtual double max_distance() const;
+
+private:
+    double a_;
+    double d_max_;
+};
+
+// f(d) = 1 if d <= a, 0 otherwise
+class WindowDecay : public DecayFunction
+{
+public:
+    explicit WindowDecay(double a);
+    virtual double log_decay(double d) const;
+    virtual double max_distance() const;
+
+private:
+    double a_;
+};
+
+// Log decay values of customers at the given coordinates (one row per customer)
+// under Euclidean distance, with the given log decay for self links. Only pairs
+// within the decay's maximum distance are visited, using a uniform grid of that
+// cell size, so the work is proportional to the number of possible links.
+SparseLogDecay compute_log_decay(const DataView& coordinates,
+                                 const DecayFunction& decay,
+                                 double self_log_decay);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef DIAGONALNORMALGAMMA_H
+#define DIAGONALNORMALGAMMA_H
+#include "LikelihoodFcn.h"
+#include <eigen3/Eigen/Core>
+#include <vector>
+
+// Normal likelihood with a diagonal covariance matrix and independent
+// Normal-Gamma priors on the mean and precision of each dimension:
+// precision ~ Gamma(v0/2, s0_j/2) and mean ~ N(mu0_j, 1 / (k0 * precision)).
+// This is the Normal-inverse-Wishart model of MultivariateNormal restricted
+// to diagonal covariances (the same for d = 1), and scores a table in O(d)
+// from its sums and sums of squares, so it suits high-dimensional features.
+class DiagonalNormalGamma : public LikelihoodFcn
+{
+public:
+    // s0 holds the prior scale of each dimension, like the diagonal of the
+    // prior scale matrix of MultivariateNormal.
+    // throws std::invalid_argument if the dimensions do not match the data or
+    // a prior parameter is not positive
+    DiagonalNormalGamma(const DataMatrix& data,
+            const Eigen::VectorXd &mu0,
+            const Eigen::VectorXd &s0,
+            double k0,
+            double v0);
+
+    virtual bool uses_diagonal_statistics() const;
+
+private:
+    virtual double compute_marginal_log_likelihood(const SufficientStatistics& stats) const;
+    virtual double compute_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                          const SufficientStatistics& b,
+                                                          const std::vector<std::size_t>& b_members) const;
+    // the terms of the score that only depend on the number of data points
+    double log_normalizer(std::size_t n) const;
+
+    double k0_;
+    double v0_;
+    Eigen::ArrayXd k0_mu0_; // k0 * mu0
+    Eigen::ArrayXd offset_; // s0 / 2 + k0 * mu0^2 / 2, per dimension
+    double prior_log_rate_; // sum of log( s0 / 2 ) over the dimensions
+    std::vector<double> log_normalizers_; // by table size, tables never exceed the number of data points
+};
+
+#endif
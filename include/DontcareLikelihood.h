@@ -6,14 +6,14 @@
 class DontcareLikelihood : public LikelihoodFcn
 {
 public:
-    DontcareLikelihood(const Eigen::MatrixXd &data,
+    DontcareLikelihood(const DataMatrix& data,
             const Eigen::VectorXd &mu0,
             const Eigen::MatrixXd &S0,
             double k0,
             double v0);
 
 private:
-    virtual double compute_marginal_log_likelihood(const std::set<std::size_t>& members) const;
+    virtual double compute_marginal_log_likelihood(const SufficientStatistics& stats) const;
 };
 
 #endif
@@ -0,0 +1,57 @@
+#ifndef FIXEDDIMENSIONNORMAL_H
+#define FIXEDDIMENSIONNORMAL_H
+#include "LikelihoodFcn.h"
+#include <eigen3/Eigen/Core>
+#include <memory>
+#include <vector>
+
+// The normal-inverse-Wishart marginal likelihood of MultivariateNormal for data
+// of dimension D known at compile time. Batches of tables are scored at once,
+// with their statistics in structure-of-arrays layout so that the unrolled
+// small matrix algebra vectorizes across tables; nothing is allocated.
+// Instantiated for D = 2 ... 8.
+template<int D>
+class FixedDimensionNormal : public LikelihoodFcn
+{
+public:
+    // unaligned, so that instances need no aligned allocation (e.g. by std::make_shared)
+    typedef Eigen::Matrix<double, D, 1, Eigen::DontAlign> Vector;
+    typedef Eigen::Matrix<double, D, D, Eigen::DontAlign> Matrix;
+
+    // throws std::invalid_argument if the data does not have D columns
+    FixedDimensionNormal(const DataMatrix& data,
+            const Eigen::VectorXd &mu0,
+            const Eigen::MatrixXd &S0,
+            double k0,
+            double v0);
+
+private:
+    virtual double compute_marginal_log_likelihood(const SufficientStatistics& stats) const;
+    virtual double compute_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                          const SufficientStatistics& b,
+                                                          const std::vector<std::size_t>& b_members) const;
+    virtual void compute_marginal_log_likelihoods(const SufficientStatistics* const* tables,
+                                                  std::size_t count,
+                                                  const SufficientStatistics* source,
+                                                  const std::vector<std::size_t>& source_members,
+                                                  double* scores) const;
+    // the terms of the score that only depend on the number of data points
+    double log_normalizer(std::size_t n) const;
+
+    double k0_;
+    double v0_;
+    Vector k0_mu0_; // k0 * mu0
+    Matrix offset_; // S0 + k0 * mu0 * mu0^T
+    double prior_log_det_; // log |S0|
+    std::vector<double> log_normalizers_; // by table size, tables never exceed the number of data points
+};
+
+// MultivariateNormal, or FixedDimensionNormal if the data dimension is 2 ... 8 and fixed_dimension is set
+std::shared_ptr<LikelihoodFcn> make_normal_likelihood(const DataMatrix& data,
+                                                      const Eigen::VectorXd &mu0,
+                                                      const Eigen::MatrixXd &S0,
+                                                      double k0,
+                                                      double v0,
+                                                      bool fixed_dimension = true);
+
+#endif
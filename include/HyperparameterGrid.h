@@ -0,0 +1,77 @@
+#ifndef HYPERPARAMETERGRID_H
+#define HYPERPARAMETERGRID_H
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Hyperparameters of the cluster likelihood sampled in one run: every
+// combination of the given strengths k and v of the prior mean and covariance
+// and scales of the prior covariance matrix, each sampled by its own chains.
+// Chains are numbered configuration by configuration. The number of tables and
+// the log marginal likelihood of the sampled tables are accumulated per
+// configuration over the samples of its chains, to compare the configurations.
+class HyperparameterGrid
+{
+public:
+    struct Configuration
+    {
+        double k_;
+        double v_;
+        double scale_; // of the prior covariance matrix
+    };
+
+    // throws std::invalid_argument if a list of values is empty
+    HyperparameterGrid(const std::vector<double>& k,
+                       const std::vector<double>& v,
+                       const std::vector<double>& scale,
+                       std::size_t chains_per_configuration);
+
+    std::size_t num_configurations() const;
+    const Configuration& get_configuration(std::size_t configuration) const;
+    std::size_t num_chains() const;
+    std::size_t chains_per_configuration() const;
+    std::size_t configuration_of_chain(std::size_t chain) const;
+
+    void add(std::size_t chain, std::size_t num_tables, double log_likelihood, double log_joint);
+
+    std::size_t num_samples(std::size_t configuration) const;
+    double mean_num_tables(std::size_t configuration) const;
+    double mean_log_likelihood(std::size_t configuration) const;
+    // sample standard deviation, NaN with less than two samples
+    double sd_log_likelihood(std::size_t configuration) const;
+    double max_log_likelihood(std::size_t configuration) const;
+    double max_log_joint(std::size_t configuration) const;
+
+    // csv file with a header line and one line per configuration: the
+    // hyperparameters, number of samples, mean number of tables, mean, standard
+    // deviation and maximum of the log marginal likelihood, and the maximum log
+    // joint probability; throws std::runtime_error if it cannot be written
+    void write(const std::string& file) const;
+
+    // binary snapshot of the accumulated results, for resuming a run; loading
+    // requires the same configurations
+    void save(SnapshotWriter& snapshot) const;
+    void load(SnapshotReader& snapshot);
+
+private:
+    // running mean and sum of squared deviations of the log likelihood (Welford),
+    // which stay accurate for log likelihoods far from zero
+    struct Result
+    {
+        std::size_t samples_;
+        std::size_t sum_tables_;
+        double mean_log_likelihood_;
+        double m2_log_likelihood_;
+        double max_log_likelihood_;
+        double max_log_joint_;
+    };
+
+    std::vector<Configuration> configurations_;
+    std::size_t chains_per_configuration_;
+    std::vector<Result> results_;
+};
+
+#endif
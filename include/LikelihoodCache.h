@@ -0,0 +1,83 @@
+#ifndef LIKELIHOODCACHE_H
+#define LIKELIHOODCACHE_H
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Bounded cache of marginal log likelihoods keyed by subset fingerprints.
+// When full, entries are evicted in CLOCK order: an entry that was hit since
+// the hand last passed it gets a second chance.
+// The cache is split into shards by fingerprint, each guarded by its own mutex,
+// so it can be used from several threads.
+class LikelihoodCache
+{
+public:
+    struct Statistics
+    {
+        std::size_t hits_;
+        std::size_t misses_;
+        std::size_t evictions_;
+        std::size_t entries_;
+        std::size_t capacity_;
+        std::size_t bytes_; // approximate memory footprint
+    };
+
+    static const std::size_t default_capacity = 1 << 20;
+
+    explicit LikelihoodCache(std::size_t capacity = default_capacity);
+
+    // the subset size is stored next to the fingerprint as an extra check against collisions
+    bool find(std::uint64_t fingerprint, std::size_t n, double& value);
+    void insert(std::uint64_t fingerprint, std::size_t n, double value);
+
+    // changing the capacity clears the cache, zero disables caching
+    void set_capacity(std::size_t capacity);
+    void clear();
+    Statistics get_statistics() const;
+
+    // binary snapshot of the entries, capacity, clock hands and counters;
+    // loading replaces the capacity by the saved one
+    void save(SnapshotWriter& snapshot) const;
+    void load(SnapshotReader& snapshot);
+
+private:
+    LikelihoodCache(const LikelihoodCache&);
+    LikelihoodCache& operator=(const LikelihoodCache&);
+
+    struct Entry
+    {
+        std::uint64_t fingerprint;
+        std::size_t n;
+        double value;
+        bool referenced;
+    };
+
+    struct Shard
+    {
+        Shard();
+        void clear();
+
+        mutable std::mutex mutex_;
+        std::size_t capacity_;
+        std::vector<Entry> entries_;
+        std::unordered_map<std::uint64_t, std::size_t> index_; // fingerprint to position in entries_
+        std::size_t hand_;
+
+        std::size_t hits_;
+        std::size_t misses_;
+        std::size_t evictions_;
+    };
+
+    static const std::size_t num_shards = 16;
+    Shard& shard(std::uint64_t fingerprint);
+
+    std::size_t capacity_;
+    Shard shards_[num_shards];
+};
+
+#endif
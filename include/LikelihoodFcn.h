@@ -1,40 +1,111 @@
 #ifndef LIKELIHOODFCN_H
 #define LIKELIHOODFCN_H
+#include "SufficientStatistics.h"
+#include "LikelihoodCache.h"
+#include "DataMatrix.h"
+#include "Metrics.h"
 #include <eigen3/Eigen/Core>
-#include <boost/functional/hash.hpp>
 #include <memory>
-#include <unordered_map>
+#include <mutex>
+#include <set>
 #include <cstddef>
 #include <vector>
 
-// Abstract class for computing marginal log likelihoods of data sets
+class ThreadPool;
+
+// Abstract class for computing marginal log likelihoods of data sets.
+// Results are cached by subset fingerprint in a cache of bounded size.
 class LikelihoodFcn
 {
 public:
-    LikelihoodFcn(const Eigen::MatrixXd& data);
+    // the data is viewed in place, shared e.g. between the chains of a
+    // multi-chain sampler or mapped from a file
+    LikelihoodFcn(const DataMatrix& data);
     virtual ~LikelihoodFcn() {}
     double get_marginal_log_likelihood(const std::set<std::size_t>& members);
 
+    // score a table, or the merge of two tables, directly from their statistics
+    double get_marginal_log_likelihood(const SufficientStatistics& stats) const;
+    double get_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                              const SufficientStatistics& b) const;
+    // as above, with the members of b listed so that they can be folded into
+    // the Cholesky factor of a by rank-1 updates when b is small
+    double get_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                              const SufficientStatistics& b,
+                                              const std::vector<std::size_t>& b_members) const;
+
+    // new cache entries held back by get_merge_log_likelihood_ratios
+    struct CacheInsert
+    {
+        std::uint64_t fingerprint_;
+        std::size_t n_;
+        double value_;
+    };
+    typedef std::vector<CacheInsert> CacheInserts;
+
+    // Log likelihood ratios of merging the source table with each of the given tables
+    // versus keeping them apart. Cache misses are scored on the thread pool if one is
+    // given. The cache is only accessed from the calling thread and in a fixed order,
+    // so the results do not depend on the number of threads.
+    // If held_back is given, the new entries are appended to it instead of inserted.
+    // Lookups alone do not change what other lookups find, so several threads may
+    // then call this at once, and the caller inserts the entries with insert_held_back
+    // in an order of its choosing.
+    void get_merge_log_likelihood_ratios(const SufficientStatistics& source,
+                                         const std::vector<std::size_t>& source_members,
+                                         const std::vector<const SufficientStatistics*>& tables,
+                                         std::vector<double>& ratios,
+                                         ThreadPool* pool = NULL,
+                                         CacheInserts* held_back = NULL) const;
+    void insert_held_back(const CacheInserts& inserts) const;
+
+    // offset for per-table Cholesky factors, or NULL if the model does not use them
+    virtual std::shared_ptr<const ScatterOffset> get_scatter_offset() const;
+    // true if the model only needs the diagonal of the scatter matrices
+    virtual bool uses_diagonal_statistics() const;
+
     Eigen::MatrixXd sample_uncentered_sum_of_squares_matrix(const std::set<std::size_t>& members) const;
     Eigen::VectorXd sample_mean(const std::set<std::size_t>& members) const;
     Eigen::VectorXd sum_data(const std::set<std::size_t>& members) const;
+    SufficientStatistics get_statistics(const std::set<std::size_t>& members) const;
     int data_dimension() const;
+    const DataView& data() const;
+
+    // maximum number of cached likelihoods, zero disables caching
+    void set_cache_capacity(std::size_t capacity);
+    LikelihoodCache::Statistics get_cache_statistics() const;
+    // binary snapshot of the cache, see LikelihoodCache::save
+    void save_cache(SnapshotWriter& snapshot) const;
+    void load_cache(SnapshotReader& snapshot);
+    // uncached evaluations so far; their time is only measured with DDCRP_METRICS
+    EvaluationMetrics get_evaluation_metrics() const;
 
 private:
-    struct SubsetHasher
-    {
-        std::size_t operator()(const std::set<std::size_t>& s) const
-        {
-            return boost::hash_range(s.begin(), s.end());
-        }
-    };
+    // uncached score of the union of a and b; the members of b, if listed, are folded
+    // into the Cholesky factor of a by rank-1 updates when b is small.
+    // Concrete classes may score the union without forming its statistics.
+    virtual double compute_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                          const SufficientStatistics& b,
+                                                          const std::vector<std::size_t>& b_members) const;
+    // uncached scores of the unions of source with each of count tables, or of the tables
+    // alone if source is NULL. Scores them one by one unless a concrete class scores
+    // the whole batch at once.
+    virtual void compute_marginal_log_likelihoods(const SufficientStatistics* const* tables,
+                                                  std::size_t count,
+                                                  const SufficientStatistics* source,
+                                                  const std::vector<std::size_t>& source_members,
+                                                  double* scores) const;
+
+    // counts evaluations, which may run on several threads at once
+    void add_evaluations(std::uint64_t evaluations, double seconds) const;
 
-    typedef std::unordered_map< std::set<std::size_t>, double, SubsetHasher> LHMap;
-    LHMap lh_;
-    Eigen::MatrixXd data_;
+    mutable LikelihoodCache cache_;
+    mutable std::mutex evaluation_mutex_;
+    mutable EvaluationMetrics evaluation_metrics_;
+    DataMatrix data_;
 
-    // concrete classes implement how to compute the likelihood of members
-    virtual double compute_marginal_log_likelihood(const std::set<std::size_t>& members) const = 0;
+    // concrete classes implement how to compute the likelihood of a subset from its statistics
+    virtual double compute_marginal_log_likelihood(const SufficientStatistics& stats) const = 0;
 };
 
 #endif
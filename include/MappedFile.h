@@ -0,0 +1,26 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+#include <cstddef>
+#include <string>
+
+// A file mapped read-only into memory. Pages are loaded on demand and shared
+// with the page cache, so several processes can map the same file.
+class MappedFile
+{
+public:
+    // throws std::runtime_error if the file cannot be mapped
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    const char* data() const;
+    std::size_t size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void* data_;
+    std::size_t size_;
+};
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef MATRIXIO_H
+#define MATRIXIO_H
+#include "DataMatrix.h"
+#include "SparseLogDecay.h"
+#include <eigen3/Eigen/Core>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Reading and writing of data and log decay matrices.
+//
+// Besides csv, matrices can be stored as float64 .npy files (C or Fortran order),
+// and log decay values in a binary compressed sparse row file:
+//   8 bytes     magic "DDCRPLD1"
+//   uint64      number of customers N
+//   uint64      number of possible links M
+//   uint64[N+1] row offsets
+//   uint64[M]   link targets, increasing within each row
+//   float64[M]  log decay values
+// all little-endian. Binary files are memory-mapped and viewed in place.
+namespace utils
+{
+
+enum FileFormat
+{
+    CSV_FILE,
+    NPY_FILE,
+    LOG_DECAY_FILE
+};
+
+// guess the format of a file from its first bytes
+FileFormat detect_file_format(const std::string& file);
+
+template<typename M, int StorageType = Eigen::RowMajor>
+M load_csv (const std::string& csvfile)
+{
+    std::ifstream indata;
+    indata.open(csvfile);
+    std::string line;
+    std::vector<double> values;
+    uint rows = 0;
+    while (std::getline(indata, line)) {
+        std::stringstream lineStream(line);
+        std::string cell;
+        while (std::getline(lineStream, cell, ',')) {
+            values.push_back(std::stod(cell));
+        }
+        ++rows;
+    }
+    return Eigen::Map<const Eigen::Matrix<typename M::Scalar, M::RowsAtCompileTime, M::ColsAtCompileTime, StorageType> >(values.data(), rows, values.size()/rows);
+}
+
+// Read a dense N-by-N log decay csv file row by row, keeping only the possible links.
+// Returns false if the matrix is not square.
+bool load_csv_log_decay(const std::string& csvfile, SparseLogDecay& log_decay);
+
+// Read possible links as lines "source,target,log decay" with zero-based indices.
+// Links that are not listed are impossible.
+SparseLogDecay load_csv_log_decay_triplets(const std::string& csvfile);
+
+// View of a mapped .npy file; a one-dimensional array is viewed as a column vector.
+// The mapping lives as long as any copy of the returned matrix.
+// Throws std::runtime_error if the file is not a float64 array of at most two dimensions.
+DataMatrix map_npy(const std::string& file);
+void save_npy(const std::string& file, const DataView& m);
+
+// csv or .npy; .npy files are mapped instead of read
+DataMatrix load_data_matrix(const std::string& file);
+Eigen::MatrixXd load_matrix(const std::string& file);
+// a matrix of one row or one column read as a vector
+Eigen::VectorXd load_vector(const std::string& file);
+// a vector of integers such as customer indices; throws std::runtime_error if an entry is not an integer
+std::vector<long> load_index_vector(const std::string& file);
+// Table label of each customer from a clustering file as written by ddCRP::print_tables,
+// one table per line listing its members; tables are labeled by their line.
+// Throws std::runtime_error unless customers 0 ... N-1 are each listed once.
+std::vector<std::size_t> load_clustering(const std::string& file);
+
+// View of a mapped binary log decay file. Throws std::runtime_error if the file is malformed.
+SparseLogDecay map_log_decay(const std::string& file);
+void save_log_decay(const std::string& file, const SparseLogDecay& log_decay);
+
+// Dense csv, dense .npy or binary log decay file. Returns false if a dense matrix is not square.
+bool load_log_decay(const std::string& file, SparseLogDecay& log_decay);
+
+}
+
+#endif
@@ -0,0 +1,112 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Counters and timers of the phases of customer updates, aggregated per sweep.
+// The phase timers and the likelihood evaluation time are only compiled in when
+// DDCRP_METRICS is defined (cmake -DENABLE_METRICS=ON); the sweep time, the
+// number of likelihood evaluations and the cache lookups are always counted.
+struct SweepMetrics
+{
+    enum Phase
+    {
+        UNLINK,           // CustomerAssignment::unlink, including the connectivity search
+        TABLE_WEIGHTS,    // summing decay values per candidate table
+        MERGE_SCORES,     // likelihood ratios of merging with each candidate table
+        TABLE_DRAW,       // building the table distribution and drawing from it
+        CUSTOMER_WEIGHTS, // decay values of the links into the chosen table
+        CUSTOMER_DRAW,    // building the link distribution and drawing from it
+        LINK,             // CustomerAssignment::link, including table merges
+        NUM_PHASES
+    };
+    static const char* phase_name(std::size_t phase);
+
+#ifdef DDCRP_METRICS
+    static const bool phases_enabled = true;
+#else
+    static const bool phases_enabled = false;
+#endif
+
+    SweepMetrics();
+    void clear();
+
+    double sweep_seconds_;
+    std::uint64_t customer_updates_;
+    std::uint64_t batches_; // groups of customers scored at the same time in parallel sweeps
+    std::uint64_t phase_calls_[NUM_PHASES];
+    double phase_seconds_[NUM_PHASES];
+
+    std::uint64_t likelihood_evaluations_; // uncached likelihood computations
+    double likelihood_seconds_; // wall time spent in them, seen from the sampling thread
+    std::uint64_t cache_hits_;
+    std::uint64_t cache_misses_;
+};
+
+// adds the lifetime of the object to a phase
+class ScopedPhaseTimer
+{
+public:
+    ScopedPhaseTimer(SweepMetrics& metrics, SweepMetrics::Phase phase)
+        : metrics_(metrics),
+          phase_(phase),
+          start_( std::chrono::steady_clock::now() )
+    {
+    }
+
+    ~ScopedPhaseTimer()
+    {
+        metrics_.phase_seconds_[phase_] += std::chrono::duration<double>( std::chrono::steady_clock::now() - start_ ).count();
+        ++metrics_.phase_calls_[phase_];
+    }
+
+private:
+    SweepMetrics& metrics_;
+    SweepMetrics::Phase phase_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// adds the lifetime of the object to a number of seconds
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(double& seconds)
+        : seconds_(seconds),
+          start_( std::chrono::steady_clock::now() )
+    {
+    }
+
+    ~ScopedTimer()
+    {
+        seconds_ += std::chrono::duration<double>( std::chrono::steady_clock::now() - start_ ).count();
+    }
+
+private:
+    double& seconds_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Uncached likelihood evaluations and their wall time.
+struct EvaluationMetrics
+{
+    EvaluationMetrics() : evaluations_(0), seconds_(0.0) {}
+    std::uint64_t evaluations_;
+    double seconds_;
+};
+
+#define DDCRP_METRICS_CONCAT_(a, b) a##b
+#define DDCRP_METRICS_CONCAT(a, b) DDCRP_METRICS_CONCAT_(a, b)
+
+#ifdef DDCRP_METRICS
+// time the rest of the enclosing scope as the given phase
+#define DDCRP_TIME_PHASE(metrics, phase) ScopedPhaseTimer DDCRP_METRICS_CONCAT(ddcrp_phase_timer_, __LINE__)(metrics, SweepMetrics::phase)
+// add the time of the rest of the enclosing scope to a number of seconds
+#define DDCRP_TIME_INTO(seconds) ScopedTimer DDCRP_METRICS_CONCAT(ddcrp_timer_, __LINE__)(seconds)
+#else
+// without timers, only mark the argument as used
+#define DDCRP_TIME_PHASE(metrics, phase) static_cast<void>(metrics)
+#define DDCRP_TIME_INTO(seconds) static_cast<void>(seconds)
+#endif
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef METRICSWRITER_H
+#define METRICSWRITER_H
+#include "Metrics.h"
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Writes the metrics of each sweep of each chain, together with its number of
+// tables and log joint probability, so that running jobs can be watched.
+// JSON lines are appended and flushed once per sweep. The Prometheus text
+// format holds the latest values of all chains, and the file is replaced
+// atomically on every flush, as expected by the node exporter's textfile collector.
+class MetricsWriter
+{
+public:
+    enum Format
+    {
+        JSON_LINES,
+        PROMETHEUS
+    };
+
+    // throws std::runtime_error if the file cannot be opened
+    MetricsWriter(const std::string& file, Format format);
+
+    void write(std::size_t chain,
+               std::size_t sweep,
+               const SweepMetrics& metrics,
+               std::size_t num_tables,
+               double log_joint);
+    // make the values written since the last flush visible
+    void flush();
+
+    // "json" or "prometheus"; throws std::invalid_argument for other names
+    static Format parse_format(const std::string& name);
+
+private:
+    std::string file_;
+    Format format_;
+    std::ofstream json_;
+    std::stringstream prometheus_;
+};
+
+#endif
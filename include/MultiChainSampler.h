@@ -0,0 +1,77 @@
+#ifndef MULTICHAINSAMPLER_H
+#define MULTICHAINSAMPLER_H
+#include "ddCRP.h"
+#include "ConvergenceDiagnostics.h"
+#include "ThreadPool.h"
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Independent ddCRP chains run in parallel on a thread pool. The chains share
+// one read-only copy of the log decay values (and of the data, if the likelihood
+// factory shares it), and are seeded seed, seed + 1, ... so that chain 0 matches
+// a single ddCRP run with the same seed.
+class MultiChainSampler
+{
+public:
+    // called once per chain: each chain needs its own likelihood, which caches results
+    typedef std::function<std::shared_ptr<LikelihoodFcn>()> LikelihoodFactory;
+
+    MultiChainSampler(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                      const LikelihoodFactory& make_likelihood,
+                      std::size_t num_chains,
+                      unsigned int seed,
+                      std::size_t num_threads = 0);
+    // runs the chains on the given pool, which may be shared, e.g. by the jobs of a batch
+    MultiChainSampler(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                      const LikelihoodFactory& make_likelihood,
+                      std::size_t num_chains,
+                      unsigned int seed,
+                      const std::shared_ptr<ThreadPool>& pool);
+
+    // pool for scoring candidate links within each chain, see ddCRP::set_thread_pool.
+    // It must be separate from the pool running the chains.
+    void set_link_thread_pool(const std::shared_ptr<ThreadPool>& pool);
+    // pool for parallel sweeps within each chain, see ddCRP::set_sweep_thread_pool;
+    // also separate from the pool running the chains
+    void set_sweep_thread_pool(const std::shared_ptr<ThreadPool>& pool);
+    // sample every chain from the prior, see ddCRP::set_prior_sampler
+    void set_prior_sampler(const std::shared_ptr<const PriorLinkSampler>& prior);
+
+    // start every chain from the given links or clustering, see ddCRP::set_links
+    void set_links(const std::vector<std::size_t>& links);
+    void set_labels(const std::vector<std::size_t>& labels);
+
+    // one sweep of every chain
+    void iterate();
+    // add the current state of every chain to the diagnostics
+    void record();
+    void clear_diagnostics();
+
+    std::size_t num_chains() const;
+    const ddCRP& get_chain(std::size_t chain) const;
+    double get_log_joint(std::size_t chain) const; // as of the last sweep
+
+    const ConvergenceDiagnostics& num_tables_diagnostics() const;
+    const ConvergenceDiagnostics& log_joint_diagnostics() const;
+    // true if R-hat and effective sample size of both traced quantities pass
+    bool converged(double max_r_hat, double min_effective_sample_size) const;
+
+    // binary snapshot of every chain (see ddCRP::save_state) and of the diagnostics;
+    // loading requires the same number of chains
+    void save(SnapshotWriter& snapshot, bool include_caches) const;
+    void load(SnapshotReader& snapshot);
+
+private:
+    void create_chains(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                       const LikelihoodFactory& make_likelihood,
+                       unsigned int seed);
+
+    std::vector< std::unique_ptr<ddCRP> > chains_;
+    std::vector<double> log_joint_;
+    std::shared_ptr<ThreadPool> pool_;
+    ConvergenceDiagnostics num_tables_;
+    ConvergenceDiagnostics log_joint_diagnostics_;
+};
+
+#endif
@@ -6,18 +6,29 @@
 class MultivariateNormal : public LikelihoodFcn
 {
 public:
-    MultivariateNormal(const Eigen::MatrixXd &data,
+    MultivariateNormal(const DataMatrix& data,
             const Eigen::VectorXd &mu0,
             const Eigen::MatrixXd &S0,
             double k0,
             double v0);
 
-private:
-    virtual double compute_marginal_log_likelihood(const std::set<std::size_t>& members) const;
-    NIWHyperParam get_posterior_hyperparameters(const std::set<std::size_t>& members) const;
+    virtual std::shared_ptr<const ScatterOffset> get_scatter_offset() const;
+
+    // log( Gamma_d(a) / Gamma_d(b) ) of the multivariate gamma function
     static double multivariate_log_gamma_ratio(double a, double b, std::size_t d);
+    // multivariate_log_gamma_ratio((v0 + n)/2, v0/2, d) for n = 0 ... max_n
+    static std::vector<double> log_gamma_ratio_table(double v0, std::size_t d, std::size_t max_n);
+
+private:
+    virtual double compute_marginal_log_likelihood(const SufficientStatistics& stats) const;
+    NIWHyperParam get_posterior_hyperparameters(const SufficientStatistics& stats) const;
+    double posterior_log_determinant(const SufficientStatistics& stats) const;
+    static double log_determinant(const Eigen::LLT<Eigen::MatrixXd>& llt);
 
     NIWHyperParam phyper_;
+    double prior_log_det_; // log |S0|, from a Cholesky factor computed once
+    std::shared_ptr<const ScatterOffset> offset_; // S0 + k0 * mu0 * mu0^T for the per-table factors
+    std::vector<double> log_gamma_ratios_; // by table size, tables never exceed the number of data points
 };
 
 #endif
@@ -5,10 +5,10 @@
 // Normal-inverse-Wishart hyperparameters
 struct NIWHyperParam
 {
-    NIWHyperParam(Eigen::VectorXd mu,
-                   Eigen::MatrixXd S,
-                   double k,
-                   double v)
+    NIWHyperParam(const Eigen::VectorXd& mu,
+                  const Eigen::MatrixXd& S,
+                  double k,
+                  double v)
         : mu_(mu),
           S_(S),
           k_(k),
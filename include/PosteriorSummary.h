@@ -0,0 +1,80 @@
+#ifndef POSTERIORSUMMARY_H
+#define POSTERIORSUMMARY_H
+#include "SparseLogDecay.h"
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Posterior summaries accumulated sample by sample, so that samples need not be
+// stored: co-assignment counts of the pairs of customers with a possible link
+// between them, the log joint probability of each sample, the sample with the
+// highest log joint probability (MAP), and a point estimate minimizing the
+// expected Binder loss over the same pairs.
+//
+// The point estimate is chosen among a bounded set of candidate samples that is
+// thinned by dropping every other candidate whenever it is full, so candidates
+// stay spread evenly over the run.
+class PosteriorSummary
+{
+public:
+    PosteriorSummary(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                     std::size_t max_candidates = 100);
+
+    // labels as given by ddCRP::get_labels
+    void add(std::size_t chain, const std::vector<std::size_t>& labels, double log_joint);
+
+    std::size_t num_samples() const;
+    // unordered pairs of customers with a possible link between them, and the
+    // fraction of samples in which each pair shares a table
+    std::size_t num_pairs() const;
+    void get_pair(std::size_t pair, std::size_t& i, std::size_t& j) const;
+    std::vector<double> co_clustering_probabilities() const;
+    const std::vector<std::size_t>& map_labels() const;
+    double map_log_joint() const;
+    // candidate with the least expected Binder loss
+    const std::vector<std::size_t>& point_estimate_labels() const;
+    double expected_binder_loss(const std::vector<std::size_t>& labels) const;
+
+    // coclustering.csv ("i,j,probability" for each pair with a possible link, i < j),
+    // log_joint.csv ("chain,sample,log joint"), map_clustering.csv and
+    // point_estimate_clustering.csv (in the format of ddCRP::print_tables)
+    void write(const std::string& prefix) const;
+
+    // binary snapshot of the accumulated summaries, for resuming a run; loading
+    // requires the same log decay values and maximum number of candidates
+    void save(SnapshotWriter& snapshot) const;
+    void load(SnapshotReader& snapshot);
+
+private:
+    std::shared_ptr<const SparseLogDecay> log_decay_;
+    // each unordered pair of customers with a possible link once: its source and log decay position
+    std::vector<std::size_t> pair_source_;
+    std::vector<std::size_t> pair_position_;
+    std::vector<std::size_t> co_assignments_; // per pair
+    std::size_t num_samples_;
+
+    struct TracePoint
+    {
+        std::size_t chain;
+        std::size_t sample;
+        double log_joint;
+    };
+    std::vector<TracePoint> log_joint_;
+    std::vector<std::size_t> samples_per_chain_;
+
+    std::vector<std::size_t> map_labels_;
+    double map_log_joint_;
+
+    std::size_t max_candidates_;
+    std::size_t candidate_stride_; // every this many samples becomes a candidate
+    std::vector< std::vector<std::size_t> > candidates_;
+    mutable std::size_t point_estimate_; // index of the best candidate, computed on demand
+    mutable bool point_estimate_valid_;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef PRIORLINKSAMPLER_H
+#define PRIORLINKSAMPLER_H
+#include "SparseLogDecay.h"
+#include <boost/random/mersenne_twister.hpp>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Draws links from the ddCRP prior, where each customer links to a possible
+// target with probability proportional to its decay value, independently of
+// all other links. An alias table of every row of log decay values is built
+// once, so that each draw takes constant time regardless of the row length.
+class PriorLinkSampler
+{
+public:
+    // throws std::invalid_argument if a row of log decay values cannot be
+    // normalized (e.g. it contains +Inf or NaN)
+    explicit PriorLinkSampler(const std::shared_ptr<const SparseLogDecay>& log_decay);
+
+    // link target of source; a customer without possible links links to itself
+    std::size_t draw(std::size_t source, boost::random::mt19937& rng) const;
+
+private:
+    std::shared_ptr<const SparseLogDecay> log_decay_;
+    // per possible link, stored at the same positions as the log decay values:
+    // probability of keeping the link's own target, and the alternative target
+    std::vector<double> keep_;
+    std::vector<std::size_t> alias_;
+};
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef SAMPLETRACE_H
+#define SAMPLETRACE_H
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Samples of all chains streamed into one file, one table label per customer
+// and sample. A table is labeled by its smallest member, so labels only change
+// for customers whose table changes, and a sample is stored as the labels that
+// differ from the previous sample of its chain when that is shorter.
+//
+// Layout, all integers as LEB128 varints, optionally inside a gzip stream:
+//   magic "DDCRPTR1", number of customers, number of chains
+//   per sample: chain, sample number, record type, then
+//     full record (type 0):  label of each customer
+//     delta record (type 1): number of changes, then (customer - previous changed customer - 1, label) pairs
+class SampleTraceWriter
+{
+public:
+    // throws std::runtime_error if the file cannot be opened
+    SampleTraceWriter(const std::string& file,
+                      std::size_t num_customers,
+                      std::size_t num_chains,
+                      bool compress,
+                      bool delta = true);
+    // continue a trace as of a snapshot taken by save(), dropping anything
+    // written to the file after the snapshot; throws std::runtime_error
+    SampleTraceWriter(const std::string& file, SnapshotReader& snapshot);
+    ~SampleTraceWriter();
+
+    void write(std::size_t chain, std::size_t sample, const std::vector<std::size_t>& labels);
+    // ends the current gzip stream so that the file can be truncated here on
+    // resume, and saves the position and the last labels of each chain
+    void save(SnapshotWriter& snapshot);
+    void close();
+
+private:
+    SampleTraceWriter(const SampleTraceWriter&);
+    SampleTraceWriter& operator=(const SampleTraceWriter&);
+    void flush(const std::string& bytes);
+    void open(const std::string& file, const char* mode);
+
+    void* file_; // gzFile
+    std::size_t num_customers_;
+    bool compress_;
+    bool delta_;
+    std::vector< std::vector<std::size_t> > previous_; // last labels of each chain
+    std::string record_;
+};
+
+class SampleTraceReader
+{
+public:
+    // throws std::runtime_error if the file is not a sample trace
+    explicit SampleTraceReader(const std::string& file);
+    ~SampleTraceReader();
+
+    std::size_t num_customers() const;
+    std::size_t num_chains() const;
+
+    // next sample in file order; returns false at the end of the trace
+    bool read(std::size_t& chain, std::size_t& sample, std::vector<std::size_t>& labels);
+
+private:
+    SampleTraceReader(const SampleTraceReader&);
+    SampleTraceReader& operator=(const SampleTraceReader&);
+    bool read_varint(std::uint64_t& x);
+    std::uint64_t expect_varint();
+    std::size_t expect_label();
+
+    void* file_; // gzFile
+    std::string path_;
+    std::size_t num_customers_;
+    std::size_t num_chains_;
+    std::vector< std::vector<std::size_t> > previous_;
+};
+
+// write labels that are the smallest member of each table in the format of
+// ddCRP::print_tables, with tables ordered by their smallest member
+void print_labels_as_tables(const std::vector<std::size_t>& labels, std::ostream& os);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <eigen3/Eigen/Core>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Binary snapshots of sampler state, for checkpointing and resuming runs.
+// Integers are written as unsigned 64 bit and doubles as IEEE 754 binary64,
+// both in the byte order of the machine, so snapshots are meant to be resumed
+// on the machine (architecture) that wrote them.
+class SnapshotWriter
+{
+public:
+    // throws std::runtime_error on write errors
+    explicit SnapshotWriter(std::ostream& os);
+
+    void write_uint64(std::uint64_t x);
+    void write_double(double x);
+    void write_bool(bool x);
+    void write_string(const std::string& s);
+    void write_sizes(const std::vector<std::size_t>& v);
+    void write_doubles(const std::vector<double>& v);
+    void write_matrix(const Eigen::MatrixXd& m);
+
+private:
+    void write_bytes(const void* p, std::size_t size);
+
+    std::ostream& os_;
+};
+
+class SnapshotReader
+{
+public:
+    // throws std::runtime_error on truncated input or unexpected values
+    explicit SnapshotReader(std::istream& is);
+
+    std::uint64_t read_uint64();
+    double read_double();
+    bool read_bool();
+    std::string read_string();
+    void read_sizes(std::vector<std::size_t>& v);
+    void read_doubles(std::vector<double>& v);
+    void read_matrix(Eigen::MatrixXd& m);
+    // read a value that must equal the given one, e.g. a dimension of the loaded model
+    void expect_uint64(std::uint64_t expected, const std::string& what);
+
+private:
+    void read_bytes(void* p, std::size_t size);
+    // a count of elements of the given size, checked against the remaining input
+    std::size_t read_count(std::size_t element_size);
+
+    std::istream& is_;
+};
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef SPARSELOGDECAY_H
+#define SPARSELOGDECAY_H
+#include <eigen3/Eigen/Core>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+// Log decay function values stored row by row as lists of possible links
+// (compressed sparse rows). Links that are not stored are impossible, i.e.
+// have log decay -Inf, so memory and work scale with the number of neighbors.
+// The rows may also be viewed in place from external arrays, e.g. a mapped file.
+class SparseLogDecay
+{
+public:
+    struct Triplet
+    {
+        std::size_t source;
+        std::size_t target;
+        double log_decay;
+    };
+
+    SparseLogDecay();
+    // keeps the finite entries of a dense N-by-N matrix, e.g. a Map of a caller's array
+    explicit SparseLogDecay(const Eigen::Ref<const Eigen::MatrixXd>& log_decay_values);
+    // entries may come in any order, -Inf entries are dropped
+    SparseLogDecay(std::size_t num_customers, std::vector<Triplet> triplets);
+    // views existing arrays in compressed sparse row layout, kept alive by owner;
+    // row_offsets has num_customers + 1 entries, targets and log_decay have num_links.
+    // With a NULL owner, the caller keeps the arrays alive and unchanged for as long
+    // as any copy of this object or a sampler using it exists.
+    SparseLogDecay(std::size_t num_customers,
+                   std::size_t num_links,
+                   const std::size_t* row_offsets,
+                   const std::size_t* targets,
+                   const double* log_decay,
+                   const std::shared_ptr<const void>& owner);
+
+    // append the possible links of the next row; targets must be increasing
+    void add_row(const std::vector<std::size_t>& targets, const std::vector<double>& log_decay);
+
+    std::size_t num_customers() const;
+    std::size_t num_links() const;
+
+    // links of row source are stored at positions row_begin(source) ... row_end(source)-1
+    std::size_t row_begin(std::size_t source) const;
+    std::size_t row_end(std::size_t source) const;
+    std::size_t target(std::size_t position) const;
+    double log_decay(std::size_t position) const;
+
+    // log decay of the link, -Inf if it is not possible
+    double operator()(std::size_t source, std::size_t target) const;
+
+    const std::size_t* row_offsets_data() const;
+    const std::size_t* targets_data() const;
+    const double* log_decay_data() const;
+
+private:
+    // arrays built by this class; shared by copies until a row is added
+    struct Storage
+    {
+        std::vector<std::size_t> row_offsets;
+        std::vector<std::size_t> targets;
+        std::vector<double> log_decay;
+    };
+    void attach(const std::shared_ptr<Storage>& storage);
+
+    std::shared_ptr<Storage> storage_; // owned arrays, or NULL when viewing external ones
+    std::shared_ptr<const void> owner_; // keeps external arrays alive
+    std::size_t num_customers_;
+    std::size_t num_links_;
+    const std::size_t* row_offsets_; // num_customers + 1 entries
+    const std::size_t* targets_;
+    const double* log_decay_;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SUFFICIENTSTATISTICS_H
+#define SUFFICIENTSTATISTICS_H
+#include <eigen3/Eigen/Core>
+#include <eigen3/Eigen/Cholesky>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+class SnapshotWriter;
+class SnapshotReader;
+
+// Cholesky factor that can be restored exactly from a saved factor, e.g. one
+// that was kept up to date by rank-1 updates
+class CholeskyFactor : public Eigen::LLT<Eigen::MatrixXd>
+{
+public:
+    CholeskyFactor() {}
+    explicit CholeskyFactor(const Eigen::MatrixXd& matrix) : Eigen::LLT<Eigen::MatrixXd>(matrix) {}
+    // llt as returned by matrixLLT() of a successful factorization
+    void restore(const Eigen::MatrixXd& llt);
+};
+
+// Positive definite matrix added to the scatter matrix before factorizing,
+// e.g. the prior scale matrix of a Normal-inverse-Wishart model.
+struct ScatterOffset
+{
+    ScatterOffset(const Eigen::MatrixXd& matrix)
+        : matrix_(matrix),
+          factor_(matrix)
+    {}
+
+    Eigen::MatrixXd matrix_;
+    CholeskyFactor factor_;
+};
+
+// Count, sum and uncentered scatter matrix of a subset of data points.
+// Tables keep these up to date as customers come and go, so that likelihoods
+// can be scored without visiting the members of the table.
+// Diagonal statistics keep only the diagonal of the scatter matrix, i.e. the
+// sum of squares of each dimension, in O(d) space and time.
+// Optionally, the Cholesky factor of offset + scatter is maintained as well,
+// with rank-1 updates and downdates for single points.
+// The subset itself is identified by an order-independent fingerprint: the XOR of
+// random 64-bit keys of its members (Zobrist hashing).
+struct SufficientStatistics
+{
+    // a single data point, i.e. a row of the data matrix
+    typedef Eigen::Ref<const Eigen::RowVectorXd, 0, Eigen::InnerStride<> > DataPoint;
+
+    // throws std::invalid_argument if an offset is given for diagonal statistics
+    SufficientStatistics(int dimension,
+                         const std::shared_ptr<const ScatterOffset>& offset = std::shared_ptr<const ScatterOffset>(),
+                         bool diagonal = false);
+
+    void add(std::size_t customer, const DataPoint& x);
+    void remove(std::size_t customer, const DataPoint& x);
+    SufficientStatistics& operator+=(const SufficientStatistics& other);
+    SufficientStatistics& operator-=(const SufficientStatistics& other);
+
+    int dimension() const;
+    bool has_factor() const;
+    bool is_diagonal() const;
+    // true if folding in num_points single points is cheaper than refactorizing
+    bool prefers_rank_updates(std::size_t num_points) const;
+    double factor_log_determinant() const;
+
+    // Binary snapshot of everything but the offset. Loading requires statistics
+    // constructed with the same dimension, offset and diagonal setting, and
+    // throws std::runtime_error otherwise.
+    void save(SnapshotWriter& snapshot) const;
+    void load(SnapshotReader& snapshot);
+
+    // random but fixed key of a customer for fingerprinting
+    static std::uint64_t customer_key(std::size_t customer);
+
+    std::size_t n_;
+    std::uint64_t fingerprint_;
+    Eigen::VectorXd sum_;
+    Eigen::MatrixXd scatter_; // sum of x * x^T over the subset, or its diagonal as a column
+
+    std::shared_ptr<const ScatterOffset> offset_; // NULL if no factor is maintained
+    CholeskyFactor factor_; // Cholesky factor of offset + scatter
+
+private:
+    void refactorize();
+
+    bool diagonal_;
+};
+
+#endif
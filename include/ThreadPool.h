@@ -0,0 +1,53 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads executing submitted tasks in FIFO order
+class ThreadPool
+{
+public:
+    // zero threads means one per hardware thread
+    explicit ThreadPool(std::size_t num_threads = 0);
+    ~ThreadPool();
+
+    template<typename F>
+    std::future<typename std::result_of<F()>::type> submit(F f);
+
+    std::size_t num_threads() const;
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void work();
+
+    std::vector<std::thread> workers_;
+    std::queue< std::function<void()> > tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_;
+};
+
+template<typename F>
+std::future<typename std::result_of<F()>::type> ThreadPool::submit(F f)
+{
+    typedef typename std::result_of<F()>::type R;
+    std::shared_ptr< std::packaged_task<R()> > task = std::make_shared< std::packaged_task<R()> >(f);
+    std::future<R> result = task->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_.push( [task](){ (*task)(); } );
+    }
+    cv_.notify_one();
+    return result;
+}
+
+#endif
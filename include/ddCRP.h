@@ -1,33 +1,164 @@
 #ifndef DDCRP_H
 #define DDCRP_H
 #include "CustomerAssignment.h"
+#include "DecayFunction.h"
 #include "LikelihoodFcn.h"
+#include "Metrics.h"
+#include "PriorLinkSampler.h"
+#include "SparseLogDecay.h"
+#include "ThreadPool.h"
 #include <eigen3/Eigen/Dense>
 #include <boost/random/mersenne_twister.hpp>
 #include <memory>
 #include <iostream>
 
+class SnapshotWriter;
+class SnapshotReader;
+
 class ddCRP
 {
 public:
-    ddCRP(const Eigen::MatrixXd& link_probabilities, unsigned int seed);
+    // keeps the possible links of a dense N-by-N matrix of log decay values
+    ddCRP(const Eigen::Ref<const Eigen::MatrixXd>& link_probabilities, unsigned int seed);
+    ddCRP(const SparseLogDecay& log_decay, unsigned int seed);
+    // shares the log decay values, e.g. between the chains of a multi-chain sampler,
+    // or views arrays owned by the caller without copying them (see SparseLogDecay)
+    ddCRP(const std::shared_ptr<const SparseLogDecay>& log_decay, unsigned int seed);
+    // decay of the Euclidean distances between customers at the given coordinates
+    ddCRP(const DataView& coordinates, const DecayFunction& decay, double self_log_decay, unsigned int seed);
+    // one sweep, i.e. an update of every customer in order
     void iterate();
+    // counters and timers of the last sweep
+    const SweepMetrics& get_metrics() const;
+    // resample the link of one customer given all other links
+    void update(std::size_t source);
     void setLikelihood(const std::shared_ptr<LikelihoodFcn>& l);
+    // score candidate tables of each customer update on a pool of worker threads;
+    // samples are the same as without a pool. NULL disables this.
+    void set_thread_pool(const std::shared_ptr<ThreadPool>& pool);
+    // Parallel sweeps on a pool of worker threads (NULL: serial sweeps in customer
+    // order). Customers are visited in an order where customers with a possible
+    // link between them are apart (by a greedy colouring of the decay graph), and
+    // customers whose updates cannot affect each other, because their own tables
+    // and the tables they can link to are all different, are scored concurrently.
+    // A customer whose tables overlap those of an earlier one is deferred, and
+    // later customers may be updated before it if their tables do not overlap its
+    // tables either, which leaves the distribution of the samples that of a serial
+    // sweep in that order. New likelihood cache entries are inserted in batch order
+    // after scoring, so the samples do not depend on the number of threads.
+    // Customers sharing a table are never updated together, so a batch holds at
+    // most one customer per table. Batches of fewer than 8 customers are scored on
+    // the calling thread. With few tables, this is slower than a serial sweep.
+    // The pool of set_thread_pool is not used during parallel sweeps.
+    void set_sweep_thread_pool(const std::shared_ptr<ThreadPool>& pool);
+    // Sample from the ddCRP prior: each sweep draws all links anew, independently
+    // of each other and of the previous sweep, and finds the tables once, so a
+    // sweep takes time linear in the number of customers. The likelihood is not
+    // evaluated, tables keep no statistics, and log_likelihood() is 0.
+    // NULL returns to Gibbs sweeps with the likelihood.
+    void set_prior_sampler(const std::shared_ptr<const PriorLinkSampler>& prior);
     void print_tables(std::ostream &os) const;
 
+    // Warm start: replace all links by the given ones. Each must be a possible
+    // link or a self link (allowed regardless of its decay, as in the initial
+    // state); throws std::invalid_argument otherwise.
+    void set_links(const std::vector<std::size_t>& links);
+    // Warm start from a clustering: customers with equal labels are seated at one
+    // table by links along possible links. A cluster whose members cannot all be
+    // connected that way is split into the parts that can.
+    void set_labels(const std::vector<std::size_t>& labels);
+
     std::size_t get_table(std::size_t customer) const;
+    // smallest member of each customer's table
+    void get_labels(std::vector<std::size_t>& labels) const;
+    // labels or links written to a caller buffer of num_customers() entries
+    void get_labels(std::size_t* labels) const;
+    void get_links(std::size_t* links) const;
     std::size_t num_tables() const;
 
+    // log probability of the current links under the ddCRP prior,
+    // log marginal likelihood of the current tables, and their sum
+    double log_prior() const;
+    double log_likelihood() const;
+    double log_joint() const;
+
+    // Binary snapshot of the complete sampler state: links and tables with their
+    // statistics, the random number generator and optionally the likelihood cache.
+    // Loading into a sampler with the same log decay values and likelihood
+    // (set before loading) continues the chain exactly where the saved one was;
+    // without the cache, likelihoods are recomputed and may differ in round-off.
+    // Throws std::runtime_error if the snapshot does not match.
+    void save_state(SnapshotWriter& snapshot, bool include_cache) const;
+    void load_state(SnapshotReader& snapshot);
+
 private:
-    void get_link_likelihoods(std::size_t source, std::vector<double>& p) const;
-    double get_link_likelihood(std::size_t source, std::size_t target) const;
+    // scratch space of one customer update, one per update scored at the same time
+    struct UpdateScratch
+    {
+        std::vector<std::size_t> tables_; // candidate tables
+        std::vector<double> p_table_; // their log weights
+        std::vector<std::size_t> link_table_; // candidate index of the table of each link in the decay row
+        std::vector<double> table_sums_;
+        std::vector<std::size_t> candidates_; // candidates other than the source table
+        std::vector<const SufficientStatistics*> candidate_stats_;
+        std::vector<double> ratios_;
+        std::vector<double> p_link_;
+        LikelihoodFcn::CacheInserts cache_inserts_; // held back while updates are scored at the same time
+        SweepMetrics metrics_; // phases timed on worker threads, added to the sweep's
+    };
+
+    void compute_log_normalizers();
+    // keep statistics of the tables of c for the likelihood, if they are used
+    void track_statistics(CustomerAssignment& c) const;
+    void prior_sweep();
+    void compute_sweep_order();
+    void parallel_sweep();
+
+    // unnormalized log probabilities of linking source to each table it has possible
+    // links into; the pool, if any, scores the candidate tables. New likelihood cache
+    // entries are appended to held_back if given (see LikelihoodFcn).
+    void score_tables(std::size_t source, UpdateScratch& s, ThreadPool* pool, SweepMetrics& metrics,
+                      LikelihoodFcn::CacheInserts* held_back = NULL) const;
+    // draw a table from the scores and then one of the links into it
+    std::size_t draw_link(std::size_t source, UpdateScratch& s);
+    // index drawn with probability proportional to exp(log_weights[i]); at least
+    // one weight must be finite. Overwrites the weights.
+    std::size_t draw_from_log_weights(std::vector<double>& log_weights);
 
     CustomerAssignment c_;
-    Eigen::MatrixXd log_decay_values_;
+    std::shared_ptr<const SparseLogDecay> log_decay_;
+    std::vector<double> log_normalizers_; // log of the sum of decay values of each row
+    // scratch: index of each table in the candidate list. Updates scored at the
+    // same time have disjoint candidate tables, so they can share it.
+    mutable std::vector<std::size_t> table_position_;
+    UpdateScratch scratch_;
+    mutable SweepMetrics metrics_; // updated by the const scoring helpers too
+
+    // parallel sweeps
+    std::shared_ptr<ThreadPool> sweep_pool_;
+    std::vector<std::size_t> sweep_order_;
+    std::vector<UpdateScratch> batch_scratch_;
+    std::vector<std::size_t> batch_;
+    std::vector<std::size_t> deferred_; // customers passed over by earlier batches, in sweep order
+    std::vector<std::size_t> next_deferred_;
+    std::vector<std::size_t> claimed_; // stamp of the batch that claimed each table
+    std::size_t claim_stamp_;
+
+    // sampling from the prior
+    std::shared_ptr<const PriorLinkSampler> prior_;
+    std::vector<std::size_t> prior_links_;
 
     std::shared_ptr<LikelihoodFcn> likelihood_;
+    std::shared_ptr<ThreadPool> pool_;
 
     boost::random::mt19937 rng_;
 };
 
+// Labels of the customers of a frame from the labels of a previous frame with a
+// different set of customers: previous[i] is the index of customer i in the
+// previous frame, or negative for a new customer, who gets a label of its own.
+// Throws std::invalid_argument if an index is out of range.
+std::vector<std::size_t> map_labels(const std::vector<std::size_t>& previous_labels,
+                                    const std::vector<long>& previous);
+
 #endif
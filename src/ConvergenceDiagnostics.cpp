@@ -0,0 +1,162 @@
+#include "ConvergenceDiagnostics.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+ConvergenceDiagnostics::ConvergenceDiagnostics(std::size_t num_chains)
+    : draws_(num_chains)
+{
+}
+
+void ConvergenceDiagnostics::add(std::size_t chain, double value)
+{
+    draws_[chain].push_back(value);
+}
+
+void ConvergenceDiagnostics::clear()
+{
+    for (auto& d : draws_)
+        d.clear();
+}
+
+void ConvergenceDiagnostics::save(SnapshotWriter& snapshot) const
+{
+    snapshot.write_uint64( draws_.size() );
+    for (const auto& d : draws_)
+        snapshot.write_doubles(d);
+}
+
+void ConvergenceDiagnostics::load(SnapshotReader& snapshot)
+{
+    snapshot.expect_uint64(draws_.size(), "number of chains");
+    for (auto& d : draws_)
+        snapshot.read_doubles(d);
+}
+
+std::size_t ConvergenceDiagnostics::num_chains() const
+{
+    return draws_.size();
+}
+
+std::size_t ConvergenceDiagnostics::num_draws() const
+{
+    std::size_t n = std::numeric_limits<std::size_t>::max();
+    for (const auto& d : draws_)
+        n = std::min(n, d.size());
+    return draws_.empty() ? 0 : n;
+}
+
+const std::vector<double>& ConvergenceDiagnostics::get_draws(std::size_t chain) const
+{
+    return draws_[chain];
+}
+
+void ConvergenceDiagnostics::split_chains(std::vector< std::vector<double> >& halves,
+                                          std::vector<double>& means,
+                                          std::vector<double>& variances) const
+{
+    const std::size_t n = num_draws() / 2;
+    halves.clear();
+    for (const auto& d : draws_)
+    {
+        halves.push_back( std::vector<double>(d.begin(), d.begin() + n) );
+        halves.push_back( std::vector<double>(d.begin() + n, d.begin() + 2 * n) );
+    }
+
+    means.assign(halves.size(), 0.0);
+    variances.assign(halves.size(), 0.0);
+    for (std::size_t m = 0; m < halves.size(); ++m)
+    {
+        for (const auto& x : halves[m])
+            means[m] += x;
+        means[m] /= n;
+        for (const auto& x : halves[m])
+            variances[m] += (x - means[m]) * (x - means[m]);
+        variances[m] /= (n - 1);
+    }
+}
+
+double ConvergenceDiagnostics::r_hat() const
+{
+    const std::size_t n = num_draws() / 2;
+    if (n < 2)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    std::vector< std::vector<double> > halves;
+    std::vector<double> means, variances;
+    split_chains(halves, means, variances);
+
+    const double m = static_cast<double>( halves.size() );
+    double mean = 0.0, W = 0.0;
+    for (std::size_t j = 0; j < halves.size(); ++j)
+    {
+        mean += means[j] / m;
+        W += variances[j] / m;
+    }
+    double B_over_n = 0.0;
+    for (std::size_t j = 0; j < halves.size(); ++j)
+        B_over_n += (means[j] - mean) * (means[j] - mean) / (m - 1.0);
+
+    // a quantity that is constant within chains has converged only if it is the same in all
+    if (W == 0.0)
+        return (B_over_n == 0.0) ? 1.0 : std::numeric_limits<double>::infinity();
+
+    const double var_plus = (static_cast<double>(n) - 1.0) / n * W + B_over_n;
+    return std::sqrt(var_plus / W);
+}
+
+double ConvergenceDiagnostics::effective_sample_size() const
+{
+    const std::size_t n = num_draws() / 2;
+    if (n < 2)
+        return std::numeric_limits<double>::quiet_NaN();
+
+    std::vector< std::vector<double> > halves;
+    std::vector<double> means, variances;
+    split_chains(halves, means, variances);
+
+    const double m = static_cast<double>( halves.size() );
+    double mean = 0.0, W = 0.0;
+    for (std::size_t j = 0; j < halves.size(); ++j)
+    {
+        mean += means[j] / m;
+        W += variances[j] / m;
+    }
+    double B_over_n = 0.0;
+    for (std::size_t j = 0; j < halves.size(); ++j)
+        B_over_n += (means[j] - mean) * (means[j] - mean) / (m - 1.0);
+
+    const double var_plus = (static_cast<double>(n) - 1.0) / n * W + B_over_n;
+    if (var_plus == 0.0)
+        return m * n;
+
+    // combined autocorrelation at lag t, BDA3 eq. (11.7)
+    auto rho = [&](std::size_t t)
+    {
+        double variogram = 0.0;
+        for (const auto& h : halves)
+        {
+            for (std::size_t i = t; i < n; ++i)
+                variogram += (h[i] - h[i - t]) * (h[i] - h[i - t]);
+        }
+        variogram /= m * (n - t);
+        return 1.0 - variogram / (2.0 * var_plus);
+    };
+
+    // Geyer's initial positive sequence: sum autocorrelations in pairs while the pair sums
+    // are positive, also keeping them monotone
+    double tau = -1.0;
+    double previous_pair = std::numeric_limits<double>::infinity();
+    for (std::size_t t = 0; t + 1 < n; t += 2)
+    {
+        double pair = rho(t) + rho(t + 1);
+        if (pair < 0.0)
+            break;
+        pair = std::min(pair, previous_pair);
+        previous_pair = pair;
+        tau += 2.0 * pair;
+    }
+
+    return m * n / std::max(tau, 1.0 / std::log10(m * n));
+}
@@ -1,88 +1,157 @@
 #include "CustomerAssignment.h"
-#include <boost/graph/connected_components.hpp>
+#include "Snapshot.h"
+#include <algorithm>
 #include <iostream>
+#include <limits>
+#include <stdexcept>
 
 CustomerAssignment::CustomerAssignment(std::size_t num_customers)
-    : g_(num_customers),
-      tables_(num_customers, 0),
-      n_tables_(num_customers)
+    : links_(num_customers),
+      incoming_(num_customers),
+      slot_(num_customers),
+      slot_table_(num_customers),
+      free_slots_(),
+      table_slot_(num_customers),
+      members_(num_customers),
+      position_(num_customers, 0),
+      data_(NULL),
+      offset_(),
+      diagonal_(false),
+      stats_(),
+      visited_(num_customers, 0),
+      visit_stamp_(0),
+      queue_a_(),
+      queue_b_()
 {
-    for (auto vit = boost::vertices(g_); vit.first != vit.second; ++vit.first)
-        boost::add_edge(*vit.first, *vit.first, g_);
-    tables_ = std::vector<std::size_t>( boost::num_vertices(g_) );
-    n_tables_ = boost::connected_components(g_, &tables_[0]);
+    // every customer starts linked to itself, alone at its own table
+    for (std::size_t c = 0; c < num_customers; ++c)
+    {
+        links_[c] = c;
+        slot_[c] = c;
+        slot_table_[c] = c;
+        table_slot_[c] = c;
+        members_[c].push_back(c);
+    }
 }
 
 void CustomerAssignment::print_tables(std::ostream& os) const
 {
-    for (std::size_t t = 0; t < n_tables_; ++t)
+    std::vector<std::size_t> m;
+    for (std::size_t t = 0; t < num_tables(); ++t)
     {
-        auto vit = vertices(g_);
-        do
+        m = members_[t];
+        std::sort(m.begin(), m.end());
+        for (std::size_t i = 0; i < m.size(); ++i)
         {
-            if (is_in_table(*vit.first, t))
-            {
-                os << *vit.first;
-                ++vit.first;
-                if ( vit.first != vit.second)
-                    os << ", ";
-            }
-            else
-            {
-                ++vit.first;
-            }
+            if (i > 0)
+                os << ", ";
+            os << m[i];
         }
-        while ( vit.first != vit.second);
-
-        os << std::endl;
+        os << "\n";
     }
 }
 
 void CustomerAssignment::unlink(std::size_t source)
 {
-    boost::remove_edge_if([source,this](Edge e){ return boost::source(e, g_) == source; }, g_);
+    // an unlinked customer is treated as linking to itself until it is linked again
+    const std::size_t target = links_[source];
+    if (target == source)
+        return;
 
-    const std::size_t c_table = tables_[source];
-    ComponentGraph f(g_,
-                     [source, c_table, this](Edge e){ return tables_[boost::source(e, g_)] == c_table; },
-                     [c_table, this](Vertex v){ return tables_[v] == c_table; });
+    std::vector<std::size_t>& in = incoming_[target];
+    in.erase( std::find(in.begin(), in.end(), source) );
+    links_[source] = source;
 
-    std::vector<std::size_t> newtables( boost::num_vertices(g_), 0 );
-    std::size_t n = boost::connected_components(f, &newtables[0] );
-    if (n > 1)
-    {
-        // newtables is filled from 0 to how many vertices left in filtered graph,
-        // while we must assign to table according to the original graphs' vertex indices.
-        for (auto fit = vertices(f); fit.first != fit.second; ++fit.first)
-        {
-            if ( newtables[*fit.first] == 1 )
-                tables_[*fit.first] = n_tables_;
-        }
-        ++n_tables_;
-    }
+    std::vector<std::size_t> leaving;
+    if ( !connected(source, target, leaving) )
+        split_table(get_table(source), leaving);
 }
 
 void CustomerAssignment::link(std::size_t source, std::size_t target)
 {
-    boost::add_edge(source, target, g_);
+    unlink(source);
+    links_[source] = target;
+    if (target == source)
+        return;
+
+    incoming_[target].push_back(source);
     std::size_t k(0), l(0);
     if (joins_tables(source, target, k, l))
+        merge_tables(k, l);
+}
+
+std::size_t CustomerAssignment::find_root(std::vector<std::size_t>& parent, std::size_t i)
+{
+    while (parent[i] != i)
+    {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+void CustomerAssignment::assign(const std::vector<std::size_t>& links)
+{
+    const std::size_t n = num_customers();
+    links_ = links;
+    for (auto& in : incoming_)
+        in.clear();
+
+    // union-find over the links, with the search queues as scratch space
+    std::vector<std::size_t>& parent = queue_a_;
+    std::vector<std::size_t>& root_table = queue_b_;
+    parent.resize(n);
+    for (std::size_t c = 0; c < n; ++c)
+        parent[c] = c;
+    for (std::size_t c = 0; c < n; ++c)
+    {
+        if (links_[c] == c)
+            continue;
+        incoming_[ links_[c] ].push_back(c);
+        const std::size_t a = find_root(parent, c);
+        const std::size_t b = find_root(parent, links_[c]);
+        if (a != b)
+            parent[std::max(a, b)] = std::min(a, b);
+    }
+
+    // the root of each table is its smallest member, so tables are numbered
+    // when their root is reached; slots are the table numbers
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    root_table.assign(n, none);
+    std::size_t num_tables = 0;
+    for (std::size_t c = 0; c < n; ++c)
     {
-        // assign to minimal table, deduct others to keep numbering consistent
-        const std::size_t tnew = std::min(k, l);
-        const std::size_t tmax = std::max(k, l);
-        for (std::size_t i = 0; i < tables_.size(); ++i)
+        const std::size_t r = find_root(parent, c);
+        if (root_table[r] == none)
         {
-            if ((tables_[i] == k) || (tables_[i] == l))
-            {
-                tables_[i] = tnew;
-            }
-            else if ( tables_[i] > tmax )
-            {
-                --tables_[i];
-            }
+            root_table[r] = num_tables++;
+            if (members_.size() < num_tables)
+                members_.push_back( std::vector<std::size_t>() );
+            members_[num_tables - 1].clear();
         }
-        --n_tables_;
+        const std::size_t t = root_table[r];
+        slot_[c] = t;
+        position_[c] = members_[t].size();
+        members_[t].push_back(c);
+    }
+    members_.resize(num_tables);
+
+    slot_table_.resize(n);
+    for (std::size_t t = 0; t < n; ++t)
+        slot_table_[t] = t;
+    table_slot_.resize(num_tables);
+    for (std::size_t t = 0; t < num_tables; ++t)
+        table_slot_[t] = t;
+    // unused slots, taken in increasing order by later splits
+    free_slots_.clear();
+    for (std::size_t s = n; s > num_tables; --s)
+        free_slots_.push_back(s - 1);
+
+    if (data_)
+    {
+        stats_.clear();
+        for (std::size_t t = 0; t < num_tables; ++t)
+            stats_.push_back( compute_statistics(members_[t]) );
     }
 }
 
@@ -91,38 +160,299 @@ bool CustomerAssignment::joins_tables(std::size_t source,
                                       std::size_t& k,
                                       std::size_t& l) const
 {
-    k = tables_[source];
-    l = tables_[target];
+    k = get_table(source);
+    l = get_table(target);
     return (k != l);
 }
 
-bool CustomerAssignment::is_in_table(std::size_t customer, std::size_t table) const
+bool CustomerAssignment::connected(std::size_t a, std::size_t b, std::vector<std::size_t>& smaller)
 {
-    return (tables_[customer] == table);
+    // Breadth-first searches from a and b in lockstep over links in either direction.
+    // Either they meet, or the one that runs out first has found the smaller component,
+    // so the work is proportional to the smaller side of a split.
+    visit_stamp_ += 2;
+    const std::size_t mark_a = visit_stamp_;
+    const std::size_t mark_b = visit_stamp_ + 1;
+    queue_a_.assign(1, a);
+    queue_b_.assign(1, b);
+    visited_[a] = mark_a;
+    visited_[b] = mark_b;
+
+    std::size_t head_a = 0, head_b = 0;
+    while (true)
+    {
+        if (head_a == queue_a_.size())
+        {
+            smaller.assign(queue_a_.begin(), queue_a_.end());
+            return false;
+        }
+        if (expand(queue_a_[head_a++], mark_a, mark_b, queue_a_))
+            return true;
+
+        if (head_b == queue_b_.size())
+        {
+            smaller.assign(queue_b_.begin(), queue_b_.end());
+            return false;
+        }
+        if (expand(queue_b_[head_b++], mark_b, mark_a, queue_b_))
+            return true;
+    }
 }
 
-std::size_t CustomerAssignment::num_customers() const
+bool CustomerAssignment::expand(std::size_t customer,
+                                std::size_t own,
+                                std::size_t other,
+                                std::vector<std::size_t>& queue)
 {
-    return boost::num_vertices(g_);
+    // queue the unvisited neighbors of customer, return true if the other search was reached
+    const std::size_t out = links_[customer];
+    if (visited_[out] == other)
+        return true;
+    if (visited_[out] != own)
+    {
+        visited_[out] = own;
+        queue.push_back(out);
+    }
+
+    for (const auto& c : incoming_[customer])
+    {
+        if (visited_[c] == other)
+            return true;
+        if (visited_[c] != own)
+        {
+            visited_[c] = own;
+            queue.push_back(c);
+        }
+    }
+    return false;
 }
 
-std::set<std::size_t> CustomerAssignment::get_table_members(std::size_t table) const
+void CustomerAssignment::split_table(std::size_t table, const std::vector<std::size_t>& leaving)
+{
+    std::size_t slot = slot_table_.size();
+    if (free_slots_.empty())
+    {
+        slot_table_.push_back(0);
+    }
+    else
+    {
+        slot = free_slots_.back();
+        free_slots_.pop_back();
+    }
+
+    const std::size_t t_new = members_.size();
+    slot_table_[slot] = t_new;
+    table_slot_.push_back(slot);
+    members_.push_back( std::vector<std::size_t>() );
+    members_[t_new].reserve(leaving.size());
+
+    std::vector<std::size_t>& rest = members_[table];
+    for (const auto& c : leaving)
+    {
+        const std::size_t last = rest.back();
+        rest[position_[c]] = last;
+        position_[last] = position_[c];
+        rest.pop_back();
+
+        slot_[c] = slot;
+        position_[c] = members_[t_new].size();
+        members_[t_new].push_back(c);
+    }
+
+    if (data_)
+    {
+        // only the split off part is summed over, the rest is what remains
+        stats_.push_back( compute_statistics(leaving) );
+        SufficientStatistics& s = stats_[table];
+        if ( s.prefers_rank_updates(leaving.size()) )
+        {
+            for (const auto& c : leaving)
+                s.remove(c, data_->row(c));
+        }
+        else
+        {
+            s -= stats_.back();
+        }
+    }
+}
+
+void CustomerAssignment::merge_tables(std::size_t k, std::size_t l)
 {
-    std::set<std::size_t> v;
-    for (std::size_t c = 0; c < num_customers(); ++c)
+    // splice the smaller table into the larger one
+    std::size_t big = k, small = l;
+    if (members_[k].size() < members_[l].size())
+        std::swap(big, small);
+
+    if (data_)
     {
-        if (is_in_table(c, table))
-            v.insert(c);
+        if ( stats_[big].prefers_rank_updates(members_[small].size()) )
+        {
+            for (const auto& c : members_[small])
+                stats_[big].add(c, data_->row(c));
+        }
+        else
+        {
+            stats_[big] += stats_[small];
+        }
     }
-    return v;
+
+    const std::size_t slot = table_slot_[big];
+    std::vector<std::size_t>& m = members_[big];
+    for (const auto& c : members_[small])
+    {
+        slot_[c] = slot;
+        position_[c] = m.size();
+        m.push_back(c);
+    }
+    remove_table(small);
+}
+
+void CustomerAssignment::remove_table(std::size_t table)
+{
+    // the last table takes the place of the removed one
+    free_slots_.push_back(table_slot_[table]);
+    const std::size_t last = members_.size() - 1;
+    if (table != last)
+    {
+        members_[table].swap(members_[last]);
+        table_slot_[table] = table_slot_[last];
+        slot_table_[ table_slot_[table] ] = table;
+        if (data_)
+            std::swap(stats_[table], stats_[last]);
+    }
+    members_.pop_back();
+    table_slot_.pop_back();
+    if (data_)
+        stats_.pop_back();
+}
+
+std::size_t CustomerAssignment::num_customers() const
+{
+    return links_.size();
+}
+
+std::set<std::size_t> CustomerAssignment::get_table_members(std::size_t table) const
+{
+    return std::set<std::size_t>(members_[table].begin(), members_[table].end());
+}
+
+const std::vector<std::size_t>& CustomerAssignment::table_members(std::size_t table) const
+{
+    return members_[table];
 }
 
 std::size_t CustomerAssignment::num_tables() const
 {
-    return n_tables_;
+    return members_.size();
 }
 
 std::size_t CustomerAssignment::get_table(std::size_t customer) const
 {
-    return tables_[customer];
+    return slot_table_[ slot_[customer] ];
+}
+
+std::size_t CustomerAssignment::get_link(std::size_t customer) const
+{
+    return links_[customer];
+}
+
+void CustomerAssignment::get_labels(std::vector<std::size_t>& labels) const
+{
+    labels.resize(num_customers());
+    get_labels(labels.data());
+}
+
+void CustomerAssignment::get_labels(std::size_t* labels) const
+{
+    for (std::size_t t = 0; t < num_tables(); ++t)
+    {
+        const std::vector<std::size_t>& m = members_[t];
+        const std::size_t label = *std::min_element(m.begin(), m.end());
+        for (std::size_t i = 0; i < m.size(); ++i)
+            labels[m[i]] = label;
+    }
+}
+
+void CustomerAssignment::track_statistics(const DataView& data,
+                                          const std::shared_ptr<const ScatterOffset>& offset,
+                                          bool diagonal)
+{
+    data_ = &data;
+    offset_ = offset;
+    diagonal_ = diagonal;
+    stats_.clear();
+    stats_.reserve(num_tables());
+    for (std::size_t t = 0; t < num_tables(); ++t)
+        stats_.push_back( compute_statistics(members_[t]) );
+}
+
+const SufficientStatistics& CustomerAssignment::get_table_statistics(std::size_t table) const
+{
+    return stats_[table];
+}
+
+SufficientStatistics CustomerAssignment::compute_statistics(const std::vector<std::size_t>& customers) const
+{
+    SufficientStatistics s(data_->cols(), offset_, diagonal_);
+    for (const auto& c : customers)
+        s.add(c, data_->row(c));
+    return s;
+}
+
+void CustomerAssignment::save(SnapshotWriter& snapshot) const
+{
+    snapshot.write_uint64( num_customers() );
+    snapshot.write_sizes(links_);
+    for (const auto& in : incoming_)
+        snapshot.write_sizes(in);
+    snapshot.write_sizes(slot_);
+    snapshot.write_sizes(slot_table_);
+    snapshot.write_sizes(free_slots_);
+    snapshot.write_sizes(table_slot_);
+    snapshot.write_uint64( num_tables() );
+    for (const auto& m : members_)
+        snapshot.write_sizes(m);
+    snapshot.write_bool(data_ != NULL);
+    for (std::size_t t = 0; (t < num_tables()) && data_; ++t)
+        stats_[t].save(snapshot);
+}
+
+void CustomerAssignment::load(SnapshotReader& snapshot)
+{
+    const std::size_t n = num_customers();
+    snapshot.expect_uint64(n, "number of customers");
+    snapshot.read_sizes(links_);
+    for (auto& in : incoming_)
+        snapshot.read_sizes(in);
+    snapshot.read_sizes(slot_);
+    snapshot.read_sizes(slot_table_);
+    snapshot.read_sizes(free_slots_);
+    snapshot.read_sizes(table_slot_);
+    members_.resize( snapshot.read_uint64() );
+    for (auto& m : members_)
+        snapshot.read_sizes(m);
+    if ( (links_.size() != n) || (slot_.size() != n) || (slot_table_.size() != n) ||
+         (members_.size() > n) || (table_slot_.size() != members_.size()) )
+        throw std::runtime_error("Malformed snapshot of customer links");
+
+    for (std::size_t t = 0; t < members_.size(); ++t)
+    {
+        for (std::size_t i = 0; i < members_[t].size(); ++i)
+        {
+            if (members_[t][i] >= n)
+                throw std::runtime_error("Malformed snapshot of customer links");
+            position_[ members_[t][i] ] = i;
+        }
+    }
+    std::fill(visited_.begin(), visited_.end(), 0);
+    visit_stamp_ = 0;
+
+    if ( snapshot.read_bool() != (data_ != NULL) )
+        throw std::runtime_error("Snapshot does not match the current run: statistics tracking differs");
+    if (data_)
+    {
+        stats_.assign( num_tables(), SufficientStatistics(data_->cols(), offset_, diagonal_) );
+        for (auto& s : stats_)
+            s.load(snapshot);
+    }
 }
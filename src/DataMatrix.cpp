@@ -0,0 +1,43 @@
+#include "DataMatrix.h"
+
+DataMatrix::DataMatrix(const Eigen::MatrixXd& data)
+    : DataMatrix( std::make_shared<const Eigen::MatrixXd>(data) )
+{
+}
+
+DataMatrix::DataMatrix(const std::shared_ptr<const Eigen::MatrixXd>& data)
+    : view_( view_of(*data) ),
+      owner_(data)
+{
+}
+
+DataMatrix::DataMatrix(const DataView& view, const std::shared_ptr<const void>& owner)
+    : view_(view),
+      owner_(owner)
+{
+}
+
+DataMatrix::DataMatrix(const DataMatrix& other)
+    : view_(other.view_),
+      owner_(other.owner_)
+{
+}
+
+DataMatrix& DataMatrix::operator=(const DataMatrix& other)
+{
+    // a Map can only be re-pointed by constructing it again in place
+    new (&view_) DataView(other.view_);
+    owner_ = other.owner_;
+    return *this;
+}
+
+DataView DataMatrix::view_of(const Eigen::MatrixXd& m)
+{
+    return view_of(m.data(), m.rows(), m.cols(), false);
+}
+
+DataView DataMatrix::view_of(const double* data, Eigen::Index rows, Eigen::Index cols, bool row_major)
+{
+    return row_major ? DataView(data, rows, cols, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(1, cols))
+                     : DataView(data, rows, cols, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(rows, 1));
+}
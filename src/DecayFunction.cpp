@@ -0,0 +1,202 @@
+#include "DecayFunction.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+std::shared_ptr<const DecayFunction> DecayFunction::create(const std::string& name, double a, double d_max)
+{
+    if (name == "exponential")
+        return std::make_shared<WindowedExponentialDecay>(a, d_max);
+    if (name == "logistic")
+        return std::make_shared<LogisticDecay>(a, d_max);
+    if (name == "window")
+        return std::make_shared<WindowDecay>(a);
+    throw std::invalid_argument("Unknown decay function " + name);
+}
+
+WindowedExponentialDecay::WindowedExponentialDecay(double a, double d_max)
+    : a_(a),
+      d_max_(d_max)
+{
+}
+
+double WindowedExponentialDecay::log_decay(double d) const
+{
+    return -d / a_;
+}
+
+double WindowedExponentialDecay::max_distance() const
+{
+    return d_max_;
+}
+
+LogisticDecay::LogisticDecay(double a, double d_max)
+    : a_(a),
+      d_max_(d_max)
+{
+}
+
+double LogisticDecay::log_decay(double d) const
+{
+    // log of exp(x) / (1 + exp(x)) without overflow
+    const double x = a_ - d;
+    return (x > 0.0) ? -std::log1p( std::exp(-x) ) : x - std::log1p( std::exp(x) );
+}
+
+double LogisticDecay::max_distance() const
+{
+    return d_max_;
+}
+
+WindowDecay::WindowDecay(double a)
+    : a_(a)
+{
+}
+
+double WindowDecay::log_decay(double) const
+{
+    return 0.0;
+}
+
+double WindowDecay::max_distance() const
+{
+    return a_;
+}
+
+namespace
+{
+
+// Customers sorted by the integer coordinates of their grid cell, so that the
+// customers of a cell can be found by binary search.
+class UniformGrid
+{
+public:
+    UniformGrid(const DataView& coordinates, double cell_size)
+        : dim_(coordinates.cols()),
+          // without a finite cutoff, or with too many adjacent cells to visit,
+          // all customers are put in one cell
+          single_cell_( !std::isfinite(cell_size) || (cell_size <= 0.0) || (dim_ > max_grid_dimension) ),
+          cells_(coordinates.rows() * dim_, 0),
+          order_(coordinates.rows())
+    {
+        if (!single_cell_)
+        {
+            for (Eigen::Index i = 0; i < coordinates.rows(); ++i)
+                for (std::size_t k = 0; k < dim_; ++k)
+                    cells_[i * dim_ + k] = static_cast<long>( std::floor(coordinates(i, k) / cell_size) );
+        }
+
+        for (std::size_t i = 0; i < order_.size(); ++i)
+            order_[i] = i;
+        std::sort(order_.begin(), order_.end(), [this](std::size_t a, std::size_t b)
+        {
+            return compare(&cells_[a * dim_], &cells_[b * dim_]) < 0;
+        });
+    }
+
+    // append the customers in cells adjacent to (or equal to) the cell of customer i
+    void neighbors(std::size_t i, std::vector<std::size_t>& out) const
+    {
+        if (single_cell_)
+        {
+            out.insert(out.end(), order_.begin(), order_.end());
+            return;
+        }
+
+        std::vector<long> cell(&cells_[i * dim_], &cells_[i * dim_] + dim_);
+        std::vector<int> offset(dim_, -1);
+        std::vector<long> query(dim_);
+        while (true)
+        {
+            for (std::size_t k = 0; k < dim_; ++k)
+                query[k] = cell[k] + offset[k];
+            const long* q = query.data();
+            auto range = std::equal_range(order_.begin(), order_.end(), q, CellLess(this));
+            out.insert(out.end(), range.first, range.second);
+
+            // next offset in {-1, 0, 1}^dim
+            std::size_t k = 0;
+            while ((k < dim_) && (offset[k] == 1))
+                offset[k++] = -1;
+            if (k == dim_)
+                break;
+            ++offset[k];
+        }
+    }
+
+private:
+    int compare(const long* a, const long* b) const
+    {
+        for (std::size_t k = 0; k < dim_; ++k)
+        {
+            if (a[k] != b[k])
+                return (a[k] < b[k]) ? -1 : 1;
+        }
+        return 0;
+    }
+
+    // compares the cell of a customer to a query cell
+    struct CellLess
+    {
+        explicit CellLess(const UniformGrid* grid) : grid_(grid) {}
+        bool operator()(std::size_t customer, const long* query) const
+        {
+            return grid_->compare(&grid_->cells_[customer * grid_->dim_], query) < 0;
+        }
+        bool operator()(const long* query, std::size_t customer) const
+        {
+            return grid_->compare(query, &grid_->cells_[customer * grid_->dim_]) < 0;
+        }
+        const UniformGrid* grid_;
+    };
+
+    static const std::size_t max_grid_dimension = 8;
+
+    std::size_t dim_;
+    bool single_cell_;
+    std::vector<long> cells_; // cell coordinates of each customer
+    std::vector<std::size_t> order_; // customers sorted by cell
+};
+
+}
+
+SparseLogDecay compute_log_decay(const DataView& coordinates,
+                                 const DecayFunction& decay,
+                                 double self_log_decay)
+{
+    const double d_max = decay.max_distance();
+    UniformGrid grid(coordinates, d_max);
+
+    SparseLogDecay log_decay;
+    std::vector<std::size_t> candidates;
+    std::vector<std::size_t> targets;
+    std::vector<double> values;
+    for (Eigen::Index i = 0; i < coordinates.rows(); ++i)
+    {
+        candidates.clear();
+        grid.neighbors(i, candidates);
+        std::sort(candidates.begin(), candidates.end());
+
+        targets.clear();
+        values.clear();
+        for (std::size_t j : candidates)
+        {
+            if (j == static_cast<std::size_t>(i))
+            {
+                targets.push_back(j);
+                values.push_back(self_log_decay);
+                continue;
+            }
+            const double d = (coordinates.row(i) - coordinates.row(j)).norm();
+            if (d <= d_max)
+            {
+                targets.push_back(j);
+                values.push_back( decay.log_decay(d) );
+            }
+        }
+        log_decay.add_row(targets, values);
+    }
+    return log_decay;
+}
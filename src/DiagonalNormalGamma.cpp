@@ -0,0 +1,76 @@
+#include "DiagonalNormalGamma.h"
+#include <boost/math/constants/constants.hpp>
+#include <cmath>
+#include <stdexcept>
+
+DiagonalNormalGamma::DiagonalNormalGamma(const DataMatrix& data,
+                                         const Eigen::VectorXd& mu0,
+                                         const Eigen::VectorXd& s0,
+                                         double k0,
+                                         double v0)
+    : LikelihoodFcn(data),
+      k0_(k0),
+      v0_(v0),
+      k0_mu0_( k0 * mu0.array() ),
+      offset_( s0.array() / 2.0 + k0 * mu0.array().square() / 2.0 ),
+      prior_log_rate_( (s0.array() / 2.0).log().sum() ),
+      log_normalizers_()
+{
+    if ( (mu0.size() != data_dimension()) || (s0.size() != data_dimension()) )
+        throw std::invalid_argument("DiagonalNormalGamma: prior dimension does not match data");
+    if ( (k0 <= 0.0) || (v0 <= 0.0) || !(s0.array() > 0.0).all() )
+        throw std::invalid_argument("DiagonalNormalGamma: prior parameters must be positive");
+
+    // each entry is computed before the table covers it
+    const std::size_t max_n = data.view_.rows();
+    log_normalizers_.reserve(max_n + 1);
+    for (std::size_t n = 0; n <= max_n; ++n)
+        log_normalizers_.push_back( log_normalizer(n) );
+}
+
+bool DiagonalNormalGamma::uses_diagonal_statistics() const
+{
+    return true;
+}
+
+// Ref. https://www.cs.ubc.ca/~murphyk/Papers/bayesGauss.pdf, Normal-Gamma prior: Marginal likelihood,
+// for each dimension with a0 = v0/2 and b0 = s0/2:
+// Gamma(a_n)/Gamma(a0) * b0^a0 / b_n^a_n * (k0/k_n)^(1/2) * (2 pi)^(-n/2)
+double DiagonalNormalGamma::log_normalizer(std::size_t n) const
+{
+    if (n < log_normalizers_.size())
+        return log_normalizers_[n];
+
+    const double num_data = static_cast<double>(n);
+    const double d = static_cast<double>( data_dimension() );
+    const double k_post = k0_ + num_data;
+    const double v_post = v0_ + num_data;
+    double l = - ( num_data * d / 2.0) * std::log( 2.0 * boost::math::constants::pi<double>() );
+    l += d * ( std::lgamma(v_post / 2.0) - std::lgamma(v0_ / 2.0) );
+    l += (v0_ / 2.0) * prior_log_rate_;
+    l += (d / 2.0) * ( std::log(k0_) - std::log(k_post) );
+    return l;
+}
+
+double DiagonalNormalGamma::compute_marginal_log_likelihood(const SufficientStatistics& stats) const
+{
+    // posterior rate b_n = b0 + k0 * mu0^2 / 2 + sum of squares / 2 - u^2 / (2 * k_n)
+    // with u = k0 * mu0 + sum
+    const double num_data = static_cast<double>(stats.n_);
+    const double k_post = k0_ + num_data;
+    const double log_rate = ( offset_ + ( stats.scatter_.col(0).array()
+                                          - (k0_mu0_ + stats.sum_.array()).square() / k_post ) / 2.0 ).log().sum();
+    return log_normalizer(stats.n_) - ( (v0_ + num_data) / 2.0 ) * log_rate;
+}
+
+double DiagonalNormalGamma::compute_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                                   const SufficientStatistics& b,
+                                                                   const std::vector<std::size_t>&) const
+{
+    // as above with the statistics of the union, without forming them
+    const double num_data = static_cast<double>(a.n_ + b.n_);
+    const double k_post = k0_ + num_data;
+    const double log_rate = ( offset_ + ( a.scatter_.col(0).array() + b.scatter_.col(0).array()
+                                          - (k0_mu0_ + a.sum_.array() + b.sum_.array()).square() / k_post ) / 2.0 ).log().sum();
+    return log_normalizer(a.n_ + b.n_) - ( (v0_ + num_data) / 2.0 ) * log_rate;
+}
@@ -1,7 +1,7 @@
 #include "DontcareLikelihood.h"
 
 DontcareLikelihood::DontcareLikelihood(
-        const Eigen::MatrixXd &data,
+        const DataMatrix& data,
         const Eigen::VectorXd &mu0,
         const Eigen::MatrixXd &S0,
         double k0,
@@ -11,7 +11,7 @@ DontcareLikelihood::DontcareLikelihood(
 
 }
 
-double DontcareLikelihood::compute_marginal_log_likelihood(const std::set<std::size_t>& members) const
+double DontcareLikelihood::compute_marginal_log_likelihood(const SufficientStatistics& stats) const
 {
     return 0.0;
 }
@@ -0,0 +1,209 @@
+#include "FixedDimensionNormal.h"
+#include "MultivariateNormal.h"
+#include <eigen3/Eigen/Cholesky>
+#include <boost/math/constants/constants.hpp>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+// tables scored together, one AVX-512 register of doubles
+const std::size_t block_size = 8;
+}
+
+template<int D>
+FixedDimensionNormal<D>::FixedDimensionNormal(const DataMatrix& data,
+                                              const Eigen::VectorXd& mu0,
+                                              const Eigen::MatrixXd& S0,
+                                              double k0,
+                                              double v0)
+    : LikelihoodFcn(data),
+      k0_(k0),
+      v0_(v0),
+      k0_mu0_(),
+      offset_(),
+      prior_log_det_(0.0),
+      log_normalizers_()
+{
+    if ((data_dimension() != D) || (mu0.size() != D) || (S0.rows() != D) || (S0.cols() != D))
+        throw std::invalid_argument("FixedDimensionNormal: dimension does not match data or prior");
+    const Vector mu = mu0;
+    const Matrix S = S0;
+    k0_mu0_ = k0 * mu;
+    offset_ = S + k0 * ( mu * mu.transpose() );
+    prior_log_det_ = 2.0 * Eigen::LLT<Matrix>(S).matrixLLT().diagonal().array().log().sum();
+
+    // each entry is computed before the table covers it
+    const std::size_t max_n = data.view_.rows();
+    log_normalizers_.reserve(max_n + 1);
+    for (std::size_t n = 0; n <= max_n; ++n)
+        log_normalizers_.push_back( log_normalizer(n) );
+}
+
+// Ref. https://www.cs.ubc.ca/~murphyk/Papers/bayesGauss.pdf page 21: Marginal likelihood,
+// as in MultivariateNormal
+template<int D>
+double FixedDimensionNormal<D>::log_normalizer(std::size_t n) const
+{
+    if (n < log_normalizers_.size())
+        return log_normalizers_[n];
+
+    const double num_data = static_cast<double>(n);
+    const double k_post = k0_ + num_data;
+    const double v_post = v0_ + num_data;
+    double l = - ( num_data * static_cast<double>(D) / 2.0) * std::log( boost::math::constants::pi<double>() );
+    l += MultivariateNormal::multivariate_log_gamma_ratio(v_post/2.0, v0_/2.0, D);
+    l += (v0_ / 2.0) * prior_log_det_;
+    l += (static_cast<double>(D) / 2.0) * ( std::log(k0_) - std::log(k_post) );
+    return l;
+}
+
+template<int D>
+double FixedDimensionNormal<D>::compute_marginal_log_likelihood(const SufficientStatistics& stats) const
+{
+    static const std::vector<std::size_t> no_members;
+    const SufficientStatistics* table = &stats;
+    double l = 0.0;
+    compute_marginal_log_likelihoods(&table, 1, NULL, no_members, &l);
+    return l;
+}
+
+template<int D>
+double FixedDimensionNormal<D>::compute_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                                       const SufficientStatistics& b,
+                                                                       const std::vector<std::size_t>& b_members) const
+{
+    const SufficientStatistics* table = &a;
+    double l = 0.0;
+    compute_marginal_log_likelihoods(&table, 1, &b, b_members, &l);
+    return l;
+}
+
+template<int D>
+void FixedDimensionNormal<D>::compute_marginal_log_likelihoods(const SufficientStatistics* const* tables,
+                                                              std::size_t count,
+                                                              const SufficientStatistics* source,
+                                                              const std::vector<std::size_t>& /* source_members */,
+                                                              double* scores) const
+{
+    // Statistics of a block of tables with the table index innermost; the lower
+    // triangle of the posterior scale matrix is packed row by row.
+    const int T = D * (D + 1) / 2;
+    double n[block_size];
+    double u[D][block_size];
+    double A[T][block_size];
+    double det[block_size];
+
+    for (std::size_t first = 0; first < count; first += block_size)
+    {
+        // gather, padding the last block with empty tables
+        const std::size_t m = std::min(block_size, count - first);
+        for (std::size_t c = 0; c < block_size; ++c)
+        {
+            n[c] = 0.0;
+            for (int i = 0, ij = 0; i < D; ++i)
+            {
+                u[i][c] = k0_mu0_(i);
+                for (int j = 0; j <= i; ++j, ++ij)
+                    A[ij][c] = offset_(i, j);
+            }
+        }
+        for (std::size_t c = 0; c < m; ++c)
+        {
+            for (const SufficientStatistics* s : { tables[first + c], source })
+            {
+                if (!s)
+                    continue;
+                const Eigen::Map<const Vector> sum( s->sum_.data() );
+                const Eigen::Map<const Matrix> scatter( s->scatter_.data() );
+                n[c] += static_cast<double>(s->n_);
+                for (int i = 0, ij = 0; i < D; ++i)
+                {
+                    u[i][c] += sum(i);
+                    for (int j = 0; j <= i; ++j, ++ij)
+                        A[ij][c] += scatter(i, j);
+                }
+            }
+        }
+
+        // posterior scale matrix S0 + scatter + k0 * mu0 * mu0^T - k_post * mu_post * mu_post^T
+        // with k_post * mu_post = u = k0 * mu0 + sum
+        for (int i = 0, ij = 0; i < D; ++i)
+            for (int j = 0; j <= i; ++j, ++ij)
+                for (std::size_t c = 0; c < block_size; ++c)
+                    A[ij][c] -= u[i][c] * u[j][c] / (k0_ + n[c]);
+
+        // LDL^T factorization in place (no square roots), the determinant is the product of D
+        for (int j = 0; j < D; ++j)
+        {
+            const int jj = j * (j + 1) / 2 + j;
+            for (int k = 0; k < j; ++k)
+            {
+                const int jk = j * (j + 1) / 2 + k;
+                const int kk = k * (k + 1) / 2 + k;
+                for (std::size_t c = 0; c < block_size; ++c)
+                    A[jj][c] -= A[jk][c] * A[jk][c] * A[kk][c];
+            }
+            for (int i = j + 1; i < D; ++i)
+            {
+                const int ij = i * (i + 1) / 2 + j;
+                for (int k = 0; k < j; ++k)
+                {
+                    const int ik = i * (i + 1) / 2 + k;
+                    const int jk = j * (j + 1) / 2 + k;
+                    const int kk = k * (k + 1) / 2 + k;
+                    for (std::size_t c = 0; c < block_size; ++c)
+                        A[ij][c] -= A[ik][c] * A[jk][c] * A[kk][c];
+                }
+                for (std::size_t c = 0; c < block_size; ++c)
+                    A[ij][c] /= A[jj][c];
+            }
+        }
+        for (std::size_t c = 0; c < block_size; ++c)
+            det[c] = 1.0;
+        for (int j = 0; j < D; ++j)
+            for (std::size_t c = 0; c < block_size; ++c)
+                det[c] *= A[j * (j + 1) / 2 + j][c];
+
+        for (std::size_t c = 0; c < m; ++c)
+        {
+            // one logarithm per table, unless the product leaves the range of doubles
+            double log_det = std::log(det[c]);
+            if ( !std::isnormal(det[c]) )
+            {
+                log_det = 0.0;
+                for (int j = 0; j < D; ++j)
+                    log_det += std::log( A[j * (j + 1) / 2 + j][c] );
+            }
+            scores[first + c] = log_normalizer( static_cast<std::size_t>(n[c]) ) - ( (v0_ + n[c]) / 2.0 ) * log_det;
+        }
+    }
+}
+
+template class FixedDimensionNormal<2>;
+template class FixedDimensionNormal<3>;
+template class FixedDimensionNormal<4>;
+template class FixedDimensionNormal<5>;
+template class FixedDimensionNormal<6>;
+template class FixedDimensionNormal<7>;
+template class FixedDimensionNormal<8>;
+
+std::shared_ptr<LikelihoodFcn> make_normal_likelihood(const DataMatrix& data,
+                                                      const Eigen::VectorXd &mu0,
+                                                      const Eigen::MatrixXd &S0,
+                                                      double k0,
+                                                      double v0,
+                                                      bool fixed_dimension)
+{
+    switch (fixed_dimension ? data.view_.cols() : 0)
+    {
+    case 2: return std::make_shared< FixedDimensionNormal<2> >(data, mu0, S0, k0, v0);
+    case 3: return std::make_shared< FixedDimensionNormal<3> >(data, mu0, S0, k0, v0);
+    case 4: return std::make_shared< FixedDimensionNormal<4> >(data, mu0, S0, k0, v0);
+    case 5: return std::make_shared< FixedDimensionNormal<5> >(data, mu0, S0, k0, v0);
+    case 6: return std::make_shared< FixedDimensionNormal<6> >(data, mu0, S0, k0, v0);
+    case 7: return std::make_shared< FixedDimensionNormal<7> >(data, mu0, S0, k0, v0);
+    case 8: return std::make_shared< FixedDimensionNormal<8> >(data, mu0, S0, k0, v0);
+    default: return std::make_shared<MultivariateNormal>(data, mu0, S0, k0, v0);
+    }
+}
@@ -0,0 +1,175 @@
+#include "HyperparameterGrid.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+
+HyperparameterGrid::HyperparameterGrid(const std::vector<double>& k,
+                                       const std::vector<double>& v,
+                                       const std::vector<double>& scale,
+                                       std::size_t chains_per_configuration)
+    : configurations_(),
+      chains_per_configuration_(chains_per_configuration),
+      results_()
+{
+    if (k.empty() || v.empty() || scale.empty())
+        throw std::invalid_argument("HyperparameterGrid: empty list of values");
+    if (chains_per_configuration == 0)
+        throw std::invalid_argument("HyperparameterGrid: no chains");
+
+    for (const auto& ki : k)
+        for (const auto& vi : v)
+            for (const auto& si : scale)
+            {
+                Configuration c;
+                c.k_ = ki;
+                c.v_ = vi;
+                c.scale_ = si;
+                configurations_.push_back(c);
+            }
+
+    Result empty;
+    empty.samples_ = 0;
+    empty.sum_tables_ = 0;
+    empty.mean_log_likelihood_ = 0.0;
+    empty.m2_log_likelihood_ = 0.0;
+    empty.max_log_likelihood_ = -std::numeric_limits<double>::infinity();
+    empty.max_log_joint_ = -std::numeric_limits<double>::infinity();
+    results_.assign(configurations_.size(), empty);
+}
+
+std::size_t HyperparameterGrid::num_configurations() const
+{
+    return configurations_.size();
+}
+
+const HyperparameterGrid::Configuration& HyperparameterGrid::get_configuration(std::size_t configuration) const
+{
+    return configurations_[configuration];
+}
+
+std::size_t HyperparameterGrid::num_chains() const
+{
+    return configurations_.size() * chains_per_configuration_;
+}
+
+std::size_t HyperparameterGrid::chains_per_configuration() const
+{
+    return chains_per_configuration_;
+}
+
+std::size_t HyperparameterGrid::configuration_of_chain(std::size_t chain) const
+{
+    return chain / chains_per_configuration_;
+}
+
+void HyperparameterGrid::add(std::size_t chain, std::size_t num_tables, double log_likelihood, double log_joint)
+{
+    Result& r = results_[ configuration_of_chain(chain) ];
+    ++r.samples_;
+    r.sum_tables_ += num_tables;
+    const double delta = log_likelihood - r.mean_log_likelihood_;
+    r.mean_log_likelihood_ += delta / r.samples_;
+    r.m2_log_likelihood_ += delta * (log_likelihood - r.mean_log_likelihood_);
+    r.max_log_likelihood_ = std::max(r.max_log_likelihood_, log_likelihood);
+    r.max_log_joint_ = std::max(r.max_log_joint_, log_joint);
+}
+
+std::size_t HyperparameterGrid::num_samples(std::size_t configuration) const
+{
+    return results_[configuration].samples_;
+}
+
+double HyperparameterGrid::mean_num_tables(std::size_t configuration) const
+{
+    const Result& r = results_[configuration];
+    if (r.samples_ == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+    return static_cast<double>(r.sum_tables_) / r.samples_;
+}
+
+double HyperparameterGrid::mean_log_likelihood(std::size_t configuration) const
+{
+    const Result& r = results_[configuration];
+    if (r.samples_ == 0)
+        return std::numeric_limits<double>::quiet_NaN();
+    return r.mean_log_likelihood_;
+}
+
+double HyperparameterGrid::sd_log_likelihood(std::size_t configuration) const
+{
+    const Result& r = results_[configuration];
+    if (r.samples_ < 2)
+        return std::numeric_limits<double>::quiet_NaN();
+    return std::sqrt( r.m2_log_likelihood_ / (r.samples_ - 1) );
+}
+
+double HyperparameterGrid::max_log_likelihood(std::size_t configuration) const
+{
+    return results_[configuration].max_log_likelihood_;
+}
+
+double HyperparameterGrid::max_log_joint(std::size_t configuration) const
+{
+    return results_[configuration].max_log_joint_;
+}
+
+void HyperparameterGrid::write(const std::string& file) const
+{
+    std::ofstream os(file);
+    os << std::setprecision(std::numeric_limits<double>::max_digits10);
+    os << "configuration,k,v,scale,samples,mean_tables,mean_log_likelihood,sd_log_likelihood,max_log_likelihood,max_log_joint\n";
+    for (std::size_t c = 0; c < num_configurations(); ++c)
+    {
+        const Configuration& h = configurations_[c];
+        os << c << "," << h.k_ << "," << h.v_ << "," << h.scale_ << ","
+           << num_samples(c) << "," << mean_num_tables(c) << ","
+           << mean_log_likelihood(c) << "," << sd_log_likelihood(c) << ","
+           << max_log_likelihood(c) << "," << max_log_joint(c) << "\n";
+    }
+    if (!os)
+        throw std::runtime_error("Cannot write " + file);
+}
+
+void HyperparameterGrid::save(SnapshotWriter& snapshot) const
+{
+    snapshot.write_uint64( num_configurations() );
+    snapshot.write_uint64(chains_per_configuration_);
+    for (std::size_t c = 0; c < num_configurations(); ++c)
+    {
+        snapshot.write_double(configurations_[c].k_);
+        snapshot.write_double(configurations_[c].v_);
+        snapshot.write_double(configurations_[c].scale_);
+        const Result& r = results_[c];
+        snapshot.write_uint64(r.samples_);
+        snapshot.write_uint64(r.sum_tables_);
+        snapshot.write_double(r.mean_log_likelihood_);
+        snapshot.write_double(r.m2_log_likelihood_);
+        snapshot.write_double(r.max_log_likelihood_);
+        snapshot.write_double(r.max_log_joint_);
+    }
+}
+
+void HyperparameterGrid::load(SnapshotReader& snapshot)
+{
+    snapshot.expect_uint64(num_configurations(), "number of hyperparameter configurations");
+    snapshot.expect_uint64(chains_per_configuration_, "number of chains per configuration");
+    for (std::size_t c = 0; c < num_configurations(); ++c)
+    {
+        const double k = snapshot.read_double();
+        const double v = snapshot.read_double();
+        const double scale = snapshot.read_double();
+        if ( (k != configurations_[c].k_) || (v != configurations_[c].v_) || (scale != configurations_[c].scale_) )
+            throw std::runtime_error("Snapshot does not match the current run: hyperparameter grid differs");
+        Result& r = results_[c];
+        r.samples_ = snapshot.read_uint64();
+        r.sum_tables_ = snapshot.read_uint64();
+        r.mean_log_likelihood_ = snapshot.read_double();
+        r.m2_log_likelihood_ = snapshot.read_double();
+        r.max_log_likelihood_ = snapshot.read_double();
+        r.max_log_joint_ = snapshot.read_double();
+    }
+}
@@ -0,0 +1,182 @@
+#include "LikelihoodCache.h"
+#include "Snapshot.h"
+#include <stdexcept>
+
+const std::size_t LikelihoodCache::default_capacity;
+const std::size_t LikelihoodCache::num_shards;
+
+LikelihoodCache::Shard::Shard()
+    : mutex_(),
+      capacity_(0),
+      entries_(),
+      index_(),
+      hand_(0),
+      hits_(0),
+      misses_(0),
+      evictions_(0)
+{
+}
+
+void LikelihoodCache::Shard::clear()
+{
+    entries_.clear();
+    entries_.shrink_to_fit();
+    index_.clear();
+    hand_ = 0;
+}
+
+LikelihoodCache::LikelihoodCache(std::size_t capacity)
+    : capacity_(0)
+{
+    set_capacity(capacity);
+}
+
+LikelihoodCache::Shard& LikelihoodCache::shard(std::uint64_t fingerprint)
+{
+    // fingerprints are well mixed, so the top bits spread subsets evenly
+    return shards_[fingerprint >> 60];
+}
+
+bool LikelihoodCache::find(std::uint64_t fingerprint, std::size_t n, double& value)
+{
+    Shard& s = shard(fingerprint);
+    std::lock_guard<std::mutex> lock(s.mutex_);
+    auto it = s.index_.find(fingerprint);
+    if ( (it != s.index_.end()) && (s.entries_[it->second].n == n) )
+    {
+        Entry& e = s.entries_[it->second];
+        e.referenced = true;
+        value = e.value;
+        ++s.hits_;
+        return true;
+    }
+    ++s.misses_;
+    return false;
+}
+
+void LikelihoodCache::insert(std::uint64_t fingerprint, std::size_t n, double value)
+{
+    Shard& s = shard(fingerprint);
+    std::lock_guard<std::mutex> lock(s.mutex_);
+    if (s.capacity_ == 0)
+        return;
+
+    auto it = s.index_.find(fingerprint);
+    if (it != s.index_.end())
+    {
+        Entry& e = s.entries_[it->second];
+        e.n = n;
+        e.value = value;
+        return;
+    }
+
+    Entry e = {fingerprint, n, value, false};
+    if (s.entries_.size() < s.capacity_)
+    {
+        s.index_.insert( std::make_pair(fingerprint, s.entries_.size()) );
+        s.entries_.push_back(e);
+        return;
+    }
+
+    // advance the clock hand to the first entry not referenced since the last pass
+    while (s.entries_[s.hand_].referenced)
+    {
+        s.entries_[s.hand_].referenced = false;
+        s.hand_ = (s.hand_ + 1) % s.capacity_;
+    }
+    s.index_.erase(s.entries_[s.hand_].fingerprint);
+    s.index_.insert( std::make_pair(fingerprint, s.hand_) );
+    s.entries_[s.hand_] = e;
+    s.hand_ = (s.hand_ + 1) % s.capacity_;
+    ++s.evictions_;
+}
+
+void LikelihoodCache::set_capacity(std::size_t capacity)
+{
+    capacity_ = capacity;
+    for (std::size_t i = 0; i < num_shards; ++i)
+    {
+        Shard& s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        s.capacity_ = capacity / num_shards + ( (i < capacity % num_shards) ? 1 : 0 );
+        s.clear();
+    }
+}
+
+void LikelihoodCache::clear()
+{
+    for (std::size_t i = 0; i < num_shards; ++i)
+    {
+        std::lock_guard<std::mutex> lock(shards_[i].mutex_);
+        shards_[i].clear();
+    }
+}
+
+LikelihoodCache::Statistics LikelihoodCache::get_statistics() const
+{
+    // hash map nodes hold the key-value pair and a next pointer, plus one pointer per bucket
+    const std::size_t node_bytes = sizeof(std::pair<const std::uint64_t, std::size_t>) + sizeof(void*);
+    Statistics st = {0, 0, 0, 0, capacity_, 0};
+    for (std::size_t i = 0; i < num_shards; ++i)
+    {
+        const Shard& s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        st.hits_ += s.hits_;
+        st.misses_ += s.misses_;
+        st.evictions_ += s.evictions_;
+        st.entries_ += s.entries_.size();
+        st.bytes_ += s.entries_.capacity() * sizeof(Entry) + s.index_.size() * node_bytes + s.index_.bucket_count() * sizeof(void*);
+    }
+    return st;
+}
+
+void LikelihoodCache::save(SnapshotWriter& snapshot) const
+{
+    snapshot.write_uint64(capacity_);
+    snapshot.write_uint64(num_shards);
+    for (std::size_t i = 0; i < num_shards; ++i)
+    {
+        const Shard& s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        snapshot.write_uint64(s.hand_);
+        snapshot.write_uint64(s.hits_);
+        snapshot.write_uint64(s.misses_);
+        snapshot.write_uint64(s.evictions_);
+        snapshot.write_uint64(s.entries_.size());
+        for (const auto& e : s.entries_)
+        {
+            snapshot.write_uint64(e.fingerprint);
+            snapshot.write_uint64(e.n);
+            snapshot.write_double(e.value);
+            snapshot.write_bool(e.referenced);
+        }
+    }
+}
+
+void LikelihoodCache::load(SnapshotReader& snapshot)
+{
+    set_capacity( snapshot.read_uint64() );
+    snapshot.expect_uint64(num_shards, "number of likelihood cache shards");
+    for (std::size_t i = 0; i < num_shards; ++i)
+    {
+        Shard& s = shards_[i];
+        std::lock_guard<std::mutex> lock(s.mutex_);
+        s.hand_ = snapshot.read_uint64();
+        s.hits_ = snapshot.read_uint64();
+        s.misses_ = snapshot.read_uint64();
+        s.evictions_ = snapshot.read_uint64();
+        const std::uint64_t num_entries = snapshot.read_uint64();
+        if ( (num_entries > s.capacity_) || ((s.capacity_ > 0) && (s.hand_ >= s.capacity_)) )
+            throw std::runtime_error("Malformed snapshot of the likelihood cache");
+        s.entries_.resize(num_entries);
+        for (std::size_t k = 0; k < num_entries; ++k)
+        {
+            Entry& e = s.entries_[k];
+            e.fingerprint = snapshot.read_uint64();
+            e.n = snapshot.read_uint64();
+            e.value = snapshot.read_double();
+            e.referenced = snapshot.read_bool();
+            s.index_.insert( std::make_pair(e.fingerprint, k) );
+        }
+    }
+}
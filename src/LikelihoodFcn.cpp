@@ -1,31 +1,236 @@
 #include "LikelihoodFcn.h"
+#include "ThreadPool.h"
+#include <algorithm>
 
-LikelihoodFcn::LikelihoodFcn(const Eigen::MatrixXd &data)
-    : lh_(),
+LikelihoodFcn::LikelihoodFcn(const DataMatrix& data)
+    : cache_(),
+      evaluation_mutex_(),
+      evaluation_metrics_(),
       data_(data)
 {
 }
 
 double LikelihoodFcn::get_marginal_log_likelihood(const std::set<std::size_t> &members)
 {
-    auto it = lh_.find(members);
-    if ( it != lh_.end() )
+    std::uint64_t fingerprint = 0;
+    for (const auto& i : members)
+        fingerprint ^= SufficientStatistics::customer_key(i);
+
+    double l = 0.0;
+    if ( !cache_.find(fingerprint, members.size(), l) )
+    {
+        double seconds = 0.0;
+        {
+            DDCRP_TIME_INTO(seconds);
+            l = compute_marginal_log_likelihood( get_statistics(members) );
+        }
+        add_evaluations(1, seconds);
+        cache_.insert(fingerprint, members.size(), l);
+    }
+    return l;
+}
+
+double LikelihoodFcn::get_marginal_log_likelihood(const SufficientStatistics& stats) const
+{
+    double l = 0.0;
+    if ( !cache_.find(stats.fingerprint_, stats.n_, l) )
+    {
+        double seconds = 0.0;
+        {
+            DDCRP_TIME_INTO(seconds);
+            l = compute_marginal_log_likelihood(stats);
+        }
+        add_evaluations(1, seconds);
+        cache_.insert(stats.fingerprint_, stats.n_, l);
+    }
+    return l;
+}
+
+double LikelihoodFcn::get_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                         const SufficientStatistics& b) const
+{
+    static const std::vector<std::size_t> no_members;
+    return get_merged_marginal_log_likelihood(a, b, no_members);
+}
+
+double LikelihoodFcn::get_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                         const SufficientStatistics& b,
+                                                         const std::vector<std::size_t>& b_members) const
+{
+    double l = 0.0;
+    if ( !cache_.find(a.fingerprint_ ^ b.fingerprint_, a.n_ + b.n_, l) )
+    {
+        double seconds = 0.0;
+        {
+            DDCRP_TIME_INTO(seconds);
+            l = compute_merged_marginal_log_likelihood(a, b, b_members);
+        }
+        add_evaluations(1, seconds);
+        cache_.insert(a.fingerprint_ ^ b.fingerprint_, a.n_ + b.n_, l);
+    }
+    return l;
+}
+
+void LikelihoodFcn::get_merge_log_likelihood_ratios(const SufficientStatistics& source,
+                                                    const std::vector<std::size_t>& source_members,
+                                                    const std::vector<const SufficientStatistics*>& tables,
+                                                    std::vector<double>& ratios,
+                                                    ThreadPool* pool,
+                                                    CacheInserts* held_back) const
+{
+    // look everything up first, collecting the misses of the tables and of their merges
+    double l_source = 0.0;
+    const bool source_missing = !cache_.find(source.fingerprint_, source.n_, l_source);
+    std::vector<double> l_table(tables.size(), 0.0);
+    std::vector<double> l_merged(tables.size(), 0.0);
+    std::vector<std::size_t> missing_table, missing_merged;
+    std::vector<const SufficientStatistics*> batch; // the missing tables, then the tables with missing merges
+    for (std::size_t i = 0; i < tables.size(); ++i)
+    {
+        const SufficientStatistics& t = *tables[i];
+        if ( !cache_.find(t.fingerprint_, t.n_, l_table[i]) )
+            missing_table.push_back(i);
+        if ( !cache_.find(t.fingerprint_ ^ source.fingerprint_, t.n_ + source.n_, l_merged[i]) )
+            missing_merged.push_back(i);
+    }
+    for (const auto& i : missing_table)
+        batch.push_back(tables[i]);
+    for (const auto& i : missing_merged)
+        batch.push_back(tables[i]);
+
+    // scores batch[first, last), splitting it where the merges begin
+    std::vector<double> scores(batch.size());
+    const std::size_t num_missing_tables = missing_table.size();
+    auto evaluate = [&](std::size_t first, std::size_t last)
+    {
+        static const std::vector<std::size_t> no_members;
+        const std::size_t split = std::min( std::max(first, num_missing_tables), last );
+        if (first < split)
+            compute_marginal_log_likelihoods(&batch[first], split - first, NULL, no_members, &scores[first]);
+        if (split < last)
+            compute_marginal_log_likelihoods(&batch[split], last - split, &source, source_members, &scores[split]);
+    };
+
+    // evaluate the misses, on the pool if there is one
+    double seconds = 0.0;
+    {
+        DDCRP_TIME_INTO(seconds);
+        if (source_missing)
+            l_source = compute_marginal_log_likelihood(source);
+
+        const std::size_t num_tasks = pool ? std::min(pool->num_threads(), batch.size()) : 1;
+        if (num_tasks > 1)
+        {
+            std::vector< std::future<void> > done;
+            for (std::size_t t = 0; t < num_tasks; ++t)
+            {
+                const std::size_t first = batch.size() * t / num_tasks;
+                const std::size_t last = batch.size() * (t + 1) / num_tasks;
+                done.push_back( pool->submit( [&evaluate, first, last](){ evaluate(first, last); } ) );
+            }
+            for (auto& d : done)
+                d.get();
+        }
+        else
+        {
+            evaluate(0, batch.size());
+        }
+    }
+    add_evaluations(batch.size() + (source_missing ? 1 : 0), seconds);
+
+    for (std::size_t j = 0; j < missing_table.size(); ++j)
+        l_table[ missing_table[j] ] = scores[j];
+    for (std::size_t j = 0; j < missing_merged.size(); ++j)
+        l_merged[ missing_merged[j] ] = scores[num_missing_tables + j];
+
+    // insert in a fixed order, so that the cache evolves the same way with any number of threads
+    auto insert = [this, held_back](std::uint64_t fingerprint, std::size_t n, double value)
+    {
+        if (held_back)
+        {
+            const CacheInsert e = {fingerprint, n, value};
+            held_back->push_back(e);
+        }
+        else
+            cache_.insert(fingerprint, n, value);
+    };
+    if (source_missing)
+        insert(source.fingerprint_, source.n_, l_source);
+    std::size_t next_table = 0, next_merged = 0;
+    for (std::size_t i = 0; i < tables.size(); ++i)
+    {
+        const SufficientStatistics& t = *tables[i];
+        if ( (next_table < missing_table.size()) && (missing_table[next_table] == i) )
+        {
+            insert(t.fingerprint_, t.n_, l_table[i]);
+            ++next_table;
+        }
+        if ( (next_merged < missing_merged.size()) && (missing_merged[next_merged] == i) )
+        {
+            insert(t.fingerprint_ ^ source.fingerprint_, t.n_ + source.n_, l_merged[i]);
+            ++next_merged;
+        }
+    }
+
+    ratios.resize(tables.size());
+    for (std::size_t i = 0; i < tables.size(); ++i)
+        ratios[i] = l_merged[i] - l_table[i] - l_source;
+}
+
+void LikelihoodFcn::insert_held_back(const CacheInserts& inserts) const
+{
+    for (const auto& e : inserts)
+        cache_.insert(e.fingerprint_, e.n_, e.value_);
+}
+
+double LikelihoodFcn::compute_merged_marginal_log_likelihood(const SufficientStatistics& a,
+                                                             const SufficientStatistics& b,
+                                                             const std::vector<std::size_t>& b_members) const
+{
+    SufficientStatistics merged(a);
+    if ( (b_members.size() == b.n_) && a.prefers_rank_updates(b.n_) )
     {
-        return it->second;
+        // fold the few points of b into the Cholesky factor of a
+        for (const auto& i : b_members)
+            merged.add(i, data_.view_.row(i));
     }
     else
     {
-        const double l = compute_marginal_log_likelihood(members);      
-        lh_.insert( std::make_pair(members, l) );
-        return l;
+        merged += b;
+    }
+    return compute_marginal_log_likelihood(merged);
+}
+
+void LikelihoodFcn::compute_marginal_log_likelihoods(const SufficientStatistics* const* tables,
+                                                    std::size_t count,
+                                                    const SufficientStatistics* source,
+                                                    const std::vector<std::size_t>& source_members,
+                                                    double* scores) const
+{
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (source)
+            scores[i] = compute_merged_marginal_log_likelihood(*tables[i], *source, source_members);
+        else
+            scores[i] = compute_marginal_log_likelihood(*tables[i]);
     }
 }
 
+std::shared_ptr<const ScatterOffset> LikelihoodFcn::get_scatter_offset() const
+{
+    return std::shared_ptr<const ScatterOffset>();
+}
+
+bool LikelihoodFcn::uses_diagonal_statistics() const
+{
+    return false;
+}
+
 Eigen::MatrixXd LikelihoodFcn::sample_uncentered_sum_of_squares_matrix(const std::set<std::size_t>& members) const
 {
     Eigen::MatrixXd S = Eigen::MatrixXd::Zero( data_dimension(), data_dimension() );
     for (const auto& i : members)
-        S += ( data_.row(i).transpose() * data_.row(i) );
+        S += ( data_.view_.row(i).transpose() * data_.view_.row(i) );
 
     return S;
 }
@@ -39,11 +244,57 @@ Eigen::VectorXd LikelihoodFcn::sum_data(const std::set<std::size_t>& members) co
 {
     Eigen::VectorXd sum = Eigen::VectorXd::Zero( data_dimension() );
     for (const auto& i : members)
-        sum += data_.row(i);
+        sum += data_.view_.row(i);
     return sum;
 }
 
+SufficientStatistics LikelihoodFcn::get_statistics(const std::set<std::size_t>& members) const
+{
+    SufficientStatistics s( data_dimension(), std::shared_ptr<const ScatterOffset>(), uses_diagonal_statistics() );
+    for (const auto& i : members)
+        s.add(i, data_.view_.row(i));
+    return s;
+}
+
 int LikelihoodFcn::data_dimension() const
 {
-    return data_.cols();
+    return data_.view_.cols();
+}
+
+const DataView& LikelihoodFcn::data() const
+{
+    return data_.view_;
+}
+
+void LikelihoodFcn::set_cache_capacity(std::size_t capacity)
+{
+    cache_.set_capacity(capacity);
+}
+
+LikelihoodCache::Statistics LikelihoodFcn::get_cache_statistics() const
+{
+    return cache_.get_statistics();
+}
+
+void LikelihoodFcn::save_cache(SnapshotWriter& snapshot) const
+{
+    cache_.save(snapshot);
+}
+
+void LikelihoodFcn::load_cache(SnapshotReader& snapshot)
+{
+    cache_.load(snapshot);
+}
+
+EvaluationMetrics LikelihoodFcn::get_evaluation_metrics() const
+{
+    std::lock_guard<std::mutex> lock(evaluation_mutex_);
+    return evaluation_metrics_;
+}
+
+void LikelihoodFcn::add_evaluations(std::uint64_t evaluations, double seconds) const
+{
+    std::lock_guard<std::mutex> lock(evaluation_mutex_);
+    evaluation_metrics_.evaluations_ += evaluations;
+    evaluation_metrics_.seconds_ += seconds;
 }
@@ -0,0 +1,56 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+MappedFile::MappedFile(const std::string& path)
+    : data_(NULL),
+      size_(0)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        const int e = errno;
+        ::close(fd);
+        throw std::runtime_error("Cannot stat " + path + ": " + std::strerror(e));
+    }
+    size_ = st.st_size;
+
+    if (size_ > 0)
+    {
+        data_ = ::mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, 0);
+        if (data_ == MAP_FAILED)
+        {
+            const int e = errno;
+            data_ = NULL;
+            ::close(fd);
+            throw std::runtime_error("Cannot map " + path + ": " + std::strerror(e));
+        }
+    }
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+        ::munmap(data_, size_);
+}
+
+const char* MappedFile::data() const
+{
+    return static_cast<const char*>(data_);
+}
+
+std::size_t MappedFile::size() const
+{
+    return size_;
+}
@@ -0,0 +1,412 @@
+#include "MatrixIO.h"
+#include "MappedFile.h"
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace
+{
+
+const char npy_magic[] = "\x93NUMPY";
+const std::size_t npy_magic_size = 6;
+const char log_decay_magic[] = "DDCRPLD1";
+const std::size_t log_decay_magic_size = 8;
+const std::size_t log_decay_header_size = log_decay_magic_size + 2 * sizeof(std::uint64_t);
+
+bool little_endian()
+{
+    const std::uint16_t x = 1;
+    return *reinterpret_cast<const unsigned char*>(&x) == 1;
+}
+
+void check_binary_support(const std::string& file)
+{
+    // binary files are viewed in place, so their integers must match the host's
+    if (!little_endian() || (sizeof(std::size_t) != sizeof(std::uint64_t)))
+        throw std::runtime_error(file + ": binary files require a little-endian host with 64-bit std::size_t");
+}
+
+std::uint64_t read_uint64(const char* p)
+{
+    std::uint64_t x;
+    std::memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+void write_uint64(std::ofstream& out, std::uint64_t x)
+{
+    out.write(reinterpret_cast<const char*>(&x), sizeof(x));
+}
+
+struct NpyHeader
+{
+    std::size_t data_offset;
+    std::string descr;
+    bool fortran_order;
+    std::vector<std::size_t> shape;
+};
+
+// value of a key in the python dict literal of an .npy header
+std::string npy_header_value(const std::string& header, const std::string& key, const std::string& file)
+{
+    std::size_t pos = header.find("'" + key + "'");
+    if (pos == std::string::npos)
+        throw std::runtime_error(file + ": .npy header has no " + key);
+    pos = header.find(':', pos);
+    if (pos == std::string::npos)
+        throw std::runtime_error(file + ": malformed .npy header");
+    pos = header.find_first_not_of(' ', pos + 1);
+    if (pos == std::string::npos)
+        throw std::runtime_error(file + ": malformed .npy header");
+    return header.substr(pos);
+}
+
+// csv or .npy, for files that should hold a dense matrix
+bool is_npy_matrix(const std::string& file)
+{
+    const utils::FileFormat format = utils::detect_file_format(file);
+    if (format == utils::LOG_DECAY_FILE)
+        throw std::runtime_error(file + ": expected a dense matrix, found a binary log decay file");
+    return (format == utils::NPY_FILE);
+}
+
+NpyHeader parse_npy_header(const char* data, std::size_t size, const std::string& file)
+{
+    if ((size < npy_magic_size + 4) || (std::memcmp(data, npy_magic, npy_magic_size) != 0))
+        throw std::runtime_error(file + ": not an .npy file");
+
+    NpyHeader h;
+    const unsigned char major = data[npy_magic_size];
+    std::size_t header_length;
+    if (major == 1)
+    {
+        header_length = static_cast<unsigned char>(data[8]) | (static_cast<unsigned char>(data[9]) << 8);
+        h.data_offset = 10 + header_length;
+    }
+    else if ((major == 2) || (major == 3))
+    {
+        if (size < 12)
+            throw std::runtime_error(file + ": truncated .npy header");
+        header_length = 0;
+        for (int b = 3; b >= 0; --b)
+            header_length = (header_length << 8) | static_cast<unsigned char>(data[8 + b]);
+        h.data_offset = 12 + header_length;
+    }
+    else
+        throw std::runtime_error(file + ": unsupported .npy version");
+    if (h.data_offset > size)
+        throw std::runtime_error(file + ": truncated .npy header");
+
+    const std::string header(data + h.data_offset - header_length, header_length);
+
+    std::string descr = npy_header_value(header, "descr", file);
+    const char quote = descr[0];
+    const std::size_t end = descr.find(quote, 1);
+    if (end == std::string::npos)
+        throw std::runtime_error(file + ": malformed .npy header");
+    h.descr = descr.substr(1, end - 1);
+
+    h.fortran_order = (npy_header_value(header, "fortran_order", file).compare(0, 4, "True") == 0);
+
+    std::string shape = npy_header_value(header, "shape", file);
+    if (shape[0] != '(')
+        throw std::runtime_error(file + ": malformed .npy header");
+    shape = shape.substr(1, shape.find(')') - 1);
+    std::stringstream shapeStream(shape);
+    std::string cell;
+    while (std::getline(shapeStream, cell, ',')) {
+        if (cell.find_first_not_of(' ') != std::string::npos)
+            h.shape.push_back(std::stoul(cell));
+    }
+    return h;
+}
+
+}
+
+namespace utils
+{
+
+FileFormat detect_file_format(const std::string& file)
+{
+    std::ifstream in(file, std::ios::binary);
+    char magic[log_decay_magic_size] = {0};
+    in.read(magic, sizeof(magic));
+    if (std::memcmp(magic, npy_magic, npy_magic_size) == 0)
+        return NPY_FILE;
+    if (std::memcmp(magic, log_decay_magic, log_decay_magic_size) == 0)
+        return LOG_DECAY_FILE;
+    return CSV_FILE;
+}
+
+bool load_csv_log_decay(const std::string& csvfile, SparseLogDecay& log_decay)
+{
+    std::ifstream indata;
+    indata.open(csvfile);
+    std::string line;
+    std::vector<std::size_t> targets;
+    std::vector<double> values;
+    std::size_t cols = 0;
+    log_decay = SparseLogDecay();
+    while (std::getline(indata, line)) {
+        std::stringstream lineStream(line);
+        std::string cell;
+        targets.clear();
+        values.clear();
+        std::size_t j = 0;
+        while (std::getline(lineStream, cell, ',')) {
+            targets.push_back(j++);
+            values.push_back(std::stod(cell));
+        }
+        if (log_decay.num_customers() == 0)
+            cols = j;
+        else if (j != cols)
+            return false;
+        log_decay.add_row(targets, values);
+    }
+    return (log_decay.num_customers() == cols);
+}
+
+SparseLogDecay load_csv_log_decay_triplets(const std::string& csvfile)
+{
+    std::ifstream indata;
+    indata.open(csvfile);
+    std::string line;
+    std::vector<SparseLogDecay::Triplet> triplets;
+    std::size_t n = 0;
+    while (std::getline(indata, line)) {
+        std::stringstream lineStream(line);
+        std::string cell;
+        SparseLogDecay::Triplet t;
+        std::getline(lineStream, cell, ',');
+        t.source = std::stoul(cell);
+        std::getline(lineStream, cell, ',');
+        t.target = std::stoul(cell);
+        std::getline(lineStream, cell, ',');
+        t.log_decay = std::stod(cell);
+        n = std::max(n, std::max(t.source, t.target) + 1);
+        triplets.push_back(t);
+    }
+    return SparseLogDecay(n, triplets);
+}
+
+DataMatrix map_npy(const std::string& file)
+{
+    std::shared_ptr<const MappedFile> mapped = std::make_shared<const MappedFile>(file);
+    const NpyHeader h = parse_npy_header(mapped->data(), mapped->size(), file);
+    if ((h.descr != "<f8") || !little_endian())
+        throw std::runtime_error(file + ": expected little-endian float64 .npy data, found " + h.descr);
+    if (h.shape.size() > 2)
+        throw std::runtime_error(file + ": expected a .npy array of at most two dimensions");
+
+    const std::size_t rows = h.shape.empty() ? 1 : h.shape[0];
+    const std::size_t cols = (h.shape.size() < 2) ? 1 : h.shape[1];
+    if (mapped->size() < h.data_offset + rows * cols * sizeof(double))
+        throw std::runtime_error(file + ": truncated .npy data");
+
+    const char* p = mapped->data() + h.data_offset;
+    const Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> stride = h.fortran_order ?
+                Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(rows, 1) :
+                Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>(1, cols);
+
+    // the header is padded so that the data is aligned; copy if a writer did not
+    if (reinterpret_cast<std::uintptr_t>(p) % alignof(double) != 0)
+    {
+        std::vector<double> values(rows * cols);
+        std::memcpy(values.data(), p, values.size() * sizeof(double));
+        return DataMatrix( Eigen::MatrixXd( DataView(values.data(), rows, cols, stride) ) );
+    }
+    return DataMatrix( DataView(reinterpret_cast<const double*>(p), rows, cols, stride), mapped );
+}
+
+void save_npy(const std::string& file, const DataView& m)
+{
+    std::stringstream header;
+    header << "{'descr': '<f8', 'fortran_order': False, 'shape': (" << m.rows() << ", " << m.cols() << "), }";
+    std::string h = header.str();
+    // pad so that the data starts at a multiple of 64 bytes
+    const std::size_t preamble = npy_magic_size + 4;
+    h.append(63 - (preamble + h.size()) % 64, ' ');
+    h.push_back('\n');
+
+    std::ofstream out(file, std::ios::binary);
+    out.write(npy_magic, npy_magic_size);
+    const char version[2] = {1, 0};
+    out.write(version, 2);
+    const unsigned char length[2] = { static_cast<unsigned char>(h.size() & 0xff), static_cast<unsigned char>(h.size() >> 8) };
+    out.write(reinterpret_cast<const char*>(length), 2);
+    out.write(h.data(), h.size());
+
+    Eigen::RowVectorXd row(m.cols());
+    for (Eigen::Index i = 0; i < m.rows(); ++i)
+    {
+        row = m.row(i);
+        out.write(reinterpret_cast<const char*>(row.data()), row.size() * sizeof(double));
+    }
+    if (!out)
+        throw std::runtime_error("Cannot write " + file);
+}
+
+DataMatrix load_data_matrix(const std::string& file)
+{
+    if (is_npy_matrix(file))
+        return map_npy(file);
+    return DataMatrix( load_csv<Eigen::MatrixXd>(file) );
+}
+
+Eigen::MatrixXd load_matrix(const std::string& file)
+{
+    if (is_npy_matrix(file))
+        return map_npy(file).view_;
+    return load_csv<Eigen::MatrixXd>(file);
+}
+
+Eigen::VectorXd load_vector(const std::string& file)
+{
+    if (is_npy_matrix(file))
+    {
+        const Eigen::MatrixXd m = map_npy(file).view_;
+        return Eigen::Map<const Eigen::VectorXd>(m.data(), m.size());
+    }
+    return load_csv<Eigen::VectorXd, Eigen::ColMajor>(file);
+}
+
+std::vector<long> load_index_vector(const std::string& file)
+{
+    const Eigen::VectorXd v = load_vector(file);
+    std::vector<long> indices(v.size());
+    for (Eigen::Index i = 0; i < v.size(); ++i)
+    {
+        indices[i] = static_cast<long>( v(i) );
+        if (static_cast<double>(indices[i]) != v(i))
+            throw std::runtime_error(file + ": entry " + std::to_string(i) + " is not an integer");
+    }
+    return indices;
+}
+
+std::vector<std::size_t> load_clustering(const std::string& file)
+{
+    std::ifstream in(file);
+    if (!in)
+        throw std::runtime_error("Cannot open " + file);
+    const std::size_t unset = std::numeric_limits<std::size_t>::max();
+    std::vector<std::size_t> labels;
+    std::size_t table = 0;
+    std::string line, cell;
+    while (std::getline(in, line))
+    {
+        std::stringstream members(line);
+        bool empty = true;
+        while (std::getline(members, cell, ','))
+        {
+            std::size_t end = 0;
+            long c = -1;
+            try
+            {
+                c = std::stol(cell, &end);
+            }
+            catch (const std::logic_error&)
+            {
+            }
+            if ( (c < 0) || (cell.find_first_not_of(" \t\r", end) != std::string::npos) )
+                throw std::runtime_error(file + ": '" + cell + "' on line " + std::to_string(table + 1) + " is not a customer index");
+            const std::size_t customer = static_cast<std::size_t>(c);
+            if (customer >= labels.size())
+                labels.resize(customer + 1, unset);
+            if (labels[customer] != unset)
+                throw std::runtime_error(file + ": customer " + std::to_string(customer) + " is listed twice");
+            labels[customer] = table;
+            empty = false;
+        }
+        if (!empty)
+            ++table;
+    }
+    for (std::size_t i = 0; i < labels.size(); ++i)
+    {
+        if (labels[i] == unset)
+            throw std::runtime_error(file + ": customer " + std::to_string(i) + " is missing");
+    }
+    return labels;
+}
+
+SparseLogDecay map_log_decay(const std::string& file)
+{
+    check_binary_support(file);
+    std::shared_ptr<const MappedFile> mapped = std::make_shared<const MappedFile>(file);
+    const char* p = mapped->data();
+    if ((mapped->size() < log_decay_header_size) || (std::memcmp(p, log_decay_magic, log_decay_magic_size) != 0))
+        throw std::runtime_error(file + ": not a binary log decay file");
+
+    const std::uint64_t n = read_uint64(p + log_decay_magic_size);
+    const std::uint64_t m = read_uint64(p + log_decay_magic_size + sizeof(std::uint64_t));
+    // bounded by the file size before multiplying, so that the offsets cannot wrap around
+    if ( (n >= mapped->size() / sizeof(std::uint64_t)) ||
+         (m >= mapped->size() / (sizeof(std::uint64_t) + sizeof(double))) )
+        throw std::runtime_error(file + ": truncated binary log decay file");
+    const std::size_t offsets_at = log_decay_header_size;
+    const std::size_t targets_at = offsets_at + (n + 1) * sizeof(std::uint64_t);
+    const std::size_t values_at = targets_at + m * sizeof(std::uint64_t);
+    if (mapped->size() < values_at + m * sizeof(double))
+        throw std::runtime_error(file + ": truncated binary log decay file");
+
+    try
+    {
+        return SparseLogDecay(n, m,
+                              reinterpret_cast<const std::size_t*>(p + offsets_at),
+                              reinterpret_cast<const std::size_t*>(p + targets_at),
+                              reinterpret_cast<const double*>(p + values_at),
+                              mapped);
+    }
+    catch (const std::logic_error& e)
+    {
+        throw std::runtime_error(file + ": " + e.what());
+    }
+}
+
+void save_log_decay(const std::string& file, const SparseLogDecay& log_decay)
+{
+    check_binary_support(file);
+    std::ofstream out(file, std::ios::binary);
+    out.write(log_decay_magic, log_decay_magic_size);
+    write_uint64(out, log_decay.num_customers());
+    write_uint64(out, log_decay.num_links());
+    out.write(reinterpret_cast<const char*>(log_decay.row_offsets_data()), (log_decay.num_customers() + 1) * sizeof(std::size_t));
+    out.write(reinterpret_cast<const char*>(log_decay.targets_data()), log_decay.num_links() * sizeof(std::size_t));
+    out.write(reinterpret_cast<const char*>(log_decay.log_decay_data()), log_decay.num_links() * sizeof(double));
+    if (!out)
+        throw std::runtime_error("Cannot write " + file);
+}
+
+bool load_log_decay(const std::string& file, SparseLogDecay& log_decay)
+{
+    switch (detect_file_format(file))
+    {
+    case LOG_DECAY_FILE:
+        log_decay = map_log_decay(file);
+        return true;
+    case NPY_FILE:
+    {
+        // the dense matrix is only scanned, its pages are not kept resident
+        const DataMatrix dense = map_npy(file);
+        const DataView& d = dense.view_;
+        if (d.rows() != d.cols())
+            return false;
+        std::vector<std::size_t> targets(d.cols());
+        std::vector<double> values(d.cols());
+        for (std::size_t j = 0; j < targets.size(); ++j)
+            targets[j] = j;
+        log_decay = SparseLogDecay();
+        for (Eigen::Index i = 0; i < d.rows(); ++i)
+        {
+            for (Eigen::Index j = 0; j < d.cols(); ++j)
+                values[j] = d(i, j);
+            log_decay.add_row(targets, values);
+        }
+        return true;
+    }
+    default:
+        return load_csv_log_decay(file, log_decay);
+    }
+}
+
+}
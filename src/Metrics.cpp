@@ -0,0 +1,30 @@
+#include "Metrics.h"
+
+const char* SweepMetrics::phase_name(std::size_t phase)
+{
+    static const char* names[NUM_PHASES] = {
+        "unlink", "table_weights", "merge_scores", "table_draw", "customer_weights", "customer_draw", "link"
+    };
+    return (phase < NUM_PHASES) ? names[phase] : "unknown";
+}
+
+SweepMetrics::SweepMetrics()
+{
+    clear();
+}
+
+void SweepMetrics::clear()
+{
+    sweep_seconds_ = 0.0;
+    customer_updates_ = 0;
+    batches_ = 0;
+    for (std::size_t p = 0; p < NUM_PHASES; ++p)
+    {
+        phase_calls_[p] = 0;
+        phase_seconds_[p] = 0.0;
+    }
+    likelihood_evaluations_ = 0;
+    likelihood_seconds_ = 0.0;
+    cache_hits_ = 0;
+    cache_misses_ = 0;
+}
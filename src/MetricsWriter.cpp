@@ -0,0 +1,109 @@
+#include "MetricsWriter.h"
+#include <cstdio>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+
+MetricsWriter::MetricsWriter(const std::string& file, Format format)
+    : file_(file),
+      format_(format),
+      json_(),
+      prometheus_()
+{
+    if (format_ == JSON_LINES)
+    {
+        json_.open(file_, std::ios::app);
+        if (!json_.is_open())
+            throw std::runtime_error("Cannot open " + file_);
+        json_ << std::setprecision(std::numeric_limits<double>::max_digits10);
+    }
+    prometheus_ << std::setprecision(std::numeric_limits<double>::max_digits10);
+}
+
+MetricsWriter::Format MetricsWriter::parse_format(const std::string& name)
+{
+    if (name == "json")
+        return JSON_LINES;
+    if (name == "prometheus")
+        return PROMETHEUS;
+    throw std::invalid_argument("Unknown metrics format " + name);
+}
+
+void MetricsWriter::write(std::size_t chain,
+                          std::size_t sweep,
+                          const SweepMetrics& m,
+                          std::size_t num_tables,
+                          double log_joint)
+{
+    if (format_ == JSON_LINES)
+    {
+        json_ << "{\"chain\": " << chain << ", \"sweep\": " << sweep
+              << ", \"num_tables\": " << num_tables << ", \"log_joint\": " << log_joint
+              << ", \"sweep_seconds\": " << m.sweep_seconds_ << ", \"customer_updates\": " << m.customer_updates_
+              << ", \"likelihood_evaluations\": " << m.likelihood_evaluations_
+              << ", \"cache_hits\": " << m.cache_hits_ << ", \"cache_misses\": " << m.cache_misses_;
+        if (SweepMetrics::phases_enabled)
+        {
+            json_ << ", \"likelihood_seconds\": " << m.likelihood_seconds_ << ", \"phases\": {";
+            for (std::size_t p = 0; p < SweepMetrics::NUM_PHASES; ++p)
+            {
+                json_ << (p > 0 ? ", " : "") << "\"" << SweepMetrics::phase_name(p) << "\": {\"calls\": "
+                      << m.phase_calls_[p] << ", \"seconds\": " << m.phase_seconds_[p] << "}";
+            }
+            json_ << "}";
+        }
+        json_ << "}\n";
+        return;
+    }
+
+    const std::string labels = "chain=\"" + std::to_string(chain) + "\"";
+    prometheus_ << "ddcrp_sweep{" << labels << "} " << sweep << "\n"
+                << "ddcrp_num_tables{" << labels << "} " << num_tables << "\n"
+                << "ddcrp_log_joint{" << labels << "} " << log_joint << "\n"
+                << "ddcrp_sweep_seconds{" << labels << "} " << m.sweep_seconds_ << "\n"
+                << "ddcrp_customer_updates{" << labels << "} " << m.customer_updates_ << "\n"
+                << "ddcrp_likelihood_evaluations{" << labels << "} " << m.likelihood_evaluations_ << "\n"
+                << "ddcrp_cache_hits{" << labels << "} " << m.cache_hits_ << "\n"
+                << "ddcrp_cache_misses{" << labels << "} " << m.cache_misses_ << "\n";
+    if (SweepMetrics::phases_enabled)
+    {
+        prometheus_ << "ddcrp_likelihood_seconds{" << labels << "} " << m.likelihood_seconds_ << "\n";
+        for (std::size_t p = 0; p < SweepMetrics::NUM_PHASES; ++p)
+        {
+            const std::string phase = labels + ",phase=\"" + SweepMetrics::phase_name(p) + "\"";
+            prometheus_ << "ddcrp_phase_calls{" << phase << "} " << m.phase_calls_[p] << "\n"
+                        << "ddcrp_phase_seconds{" << phase << "} " << m.phase_seconds_[p] << "\n";
+        }
+    }
+}
+
+void MetricsWriter::flush()
+{
+    if (format_ == JSON_LINES)
+    {
+        json_.flush();
+        return;
+    }
+
+    // all values are per sweep, i.e. gauges
+    static const char* gauges[] = {
+        "ddcrp_sweep", "ddcrp_num_tables", "ddcrp_log_joint", "ddcrp_sweep_seconds", "ddcrp_customer_updates",
+        "ddcrp_likelihood_evaluations", "ddcrp_cache_hits", "ddcrp_cache_misses",
+        "ddcrp_likelihood_seconds", "ddcrp_phase_calls", "ddcrp_phase_seconds"
+    };
+    const std::size_t num_gauges = SweepMetrics::phases_enabled ? 11 : 8;
+
+    // write a temporary file and rename it, so that readers never see a partial file
+    const std::string tmp = file_ + ".tmp";
+    {
+        std::ofstream out(tmp);
+        for (std::size_t g = 0; g < num_gauges; ++g)
+            out << "# TYPE " << gauges[g] << " gauge\n";
+        out << prometheus_.str();
+        if (!out)
+            throw std::runtime_error("Cannot write " + tmp);
+    }
+    if (std::rename(tmp.c_str(), file_.c_str()) != 0)
+        throw std::runtime_error("Cannot replace " + file_);
+    prometheus_.str("");
+}
@@ -0,0 +1,163 @@
+#include "MultiChainSampler.h"
+#include "Snapshot.h"
+#include <future>
+#include <stdexcept>
+
+MultiChainSampler::MultiChainSampler(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                                     const LikelihoodFactory& make_likelihood,
+                                     std::size_t num_chains,
+                                     unsigned int seed,
+                                     std::size_t num_threads)
+    : chains_(),
+      log_joint_(num_chains, 0.0),
+      pool_( std::make_shared<ThreadPool>(num_threads == 0 ? 0 : std::min(num_threads, num_chains)) ),
+      num_tables_(num_chains),
+      log_joint_diagnostics_(num_chains)
+{
+    create_chains(log_decay, make_likelihood, seed);
+}
+
+MultiChainSampler::MultiChainSampler(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                                     const LikelihoodFactory& make_likelihood,
+                                     std::size_t num_chains,
+                                     unsigned int seed,
+                                     const std::shared_ptr<ThreadPool>& pool)
+    : chains_(),
+      log_joint_(num_chains, 0.0),
+      pool_(pool),
+      num_tables_(num_chains),
+      log_joint_diagnostics_(num_chains)
+{
+    create_chains(log_decay, make_likelihood, seed);
+}
+
+void MultiChainSampler::create_chains(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                                      const LikelihoodFactory& make_likelihood,
+                                      unsigned int seed)
+{
+    for (std::size_t k = 0; k < log_joint_.size(); ++k)
+    {
+        chains_.push_back( std::unique_ptr<ddCRP>( new ddCRP(log_decay, seed + k) ) );
+        chains_.back()->setLikelihood( make_likelihood() );
+    }
+}
+
+void MultiChainSampler::set_link_thread_pool(const std::shared_ptr<ThreadPool>& pool)
+{
+    for (auto& c : chains_)
+        c->set_thread_pool(pool);
+}
+
+void MultiChainSampler::set_links(const std::vector<std::size_t>& links)
+{
+    for (auto& c : chains_)
+        c->set_links(links);
+}
+
+void MultiChainSampler::set_labels(const std::vector<std::size_t>& labels)
+{
+    for (auto& c : chains_)
+        c->set_labels(labels);
+}
+
+void MultiChainSampler::set_sweep_thread_pool(const std::shared_ptr<ThreadPool>& pool)
+{
+    for (auto& c : chains_)
+        c->set_sweep_thread_pool(pool);
+}
+
+void MultiChainSampler::set_prior_sampler(const std::shared_ptr<const PriorLinkSampler>& prior)
+{
+    for (auto& c : chains_)
+        c->set_prior_sampler(prior);
+}
+
+void MultiChainSampler::iterate()
+{
+    std::vector< std::future<void> > done;
+    for (std::size_t k = 0; k < chains_.size(); ++k)
+    {
+        done.push_back( pool_->submit( [this, k]()
+        {
+            chains_[k]->iterate();
+            log_joint_[k] = chains_[k]->log_joint();
+        }) );
+    }
+    for (auto& d : done)
+        d.get();
+}
+
+void MultiChainSampler::record()
+{
+    for (std::size_t k = 0; k < chains_.size(); ++k)
+    {
+        num_tables_.add(k, static_cast<double>( chains_[k]->num_tables() ));
+        log_joint_diagnostics_.add(k, log_joint_[k]);
+    }
+}
+
+void MultiChainSampler::clear_diagnostics()
+{
+    num_tables_.clear();
+    log_joint_diagnostics_.clear();
+}
+
+std::size_t MultiChainSampler::num_chains() const
+{
+    return chains_.size();
+}
+
+const ddCRP& MultiChainSampler::get_chain(std::size_t chain) const
+{
+    return *chains_[chain];
+}
+
+double MultiChainSampler::get_log_joint(std::size_t chain) const
+{
+    return log_joint_[chain];
+}
+
+const ConvergenceDiagnostics& MultiChainSampler::num_tables_diagnostics() const
+{
+    return num_tables_;
+}
+
+const ConvergenceDiagnostics& MultiChainSampler::log_joint_diagnostics() const
+{
+    return log_joint_diagnostics_;
+}
+
+bool MultiChainSampler::converged(double max_r_hat, double min_effective_sample_size) const
+{
+    for (const ConvergenceDiagnostics* d : { &num_tables_, &log_joint_diagnostics_ })
+    {
+        const double r = d->r_hat();
+        const double n_eff = d->effective_sample_size();
+        // comparisons with NaN (too few draws) are false
+        if ( !(r <= max_r_hat) || !(n_eff >= min_effective_sample_size) )
+            return false;
+    }
+    return true;
+}
+
+void MultiChainSampler::save(SnapshotWriter& snapshot, bool include_caches) const
+{
+    snapshot.write_uint64( chains_.size() );
+    snapshot.write_doubles(log_joint_);
+    num_tables_.save(snapshot);
+    log_joint_diagnostics_.save(snapshot);
+    for (const auto& c : chains_)
+        c->save_state(snapshot, include_caches);
+}
+
+void MultiChainSampler::load(SnapshotReader& snapshot)
+{
+    snapshot.expect_uint64(chains_.size(), "number of chains");
+    snapshot.read_doubles(log_joint_);
+    if (log_joint_.size() != chains_.size())
+        throw std::runtime_error("Malformed snapshot of the chains");
+    num_tables_.load(snapshot);
+    log_joint_diagnostics_.load(snapshot);
+    for (auto& c : chains_)
+        c->load_state(snapshot);
+}
@@ -5,41 +5,75 @@
 #include <cmath>
 #include <iostream>
 
-MultivariateNormal::MultivariateNormal(const Eigen::MatrixXd& data,
+MultivariateNormal::MultivariateNormal(const DataMatrix& data,
                                        const Eigen::VectorXd& mu0,
                                        const Eigen::MatrixXd& S0,
                                        double k0,
                                        double v0)
     : LikelihoodFcn(data),
-      phyper_(mu0, S0, k0, v0)
+      phyper_(mu0, S0, k0, v0),
+      prior_log_det_( log_determinant( Eigen::LLT<Eigen::MatrixXd>(S0) ) ),
+      offset_( std::make_shared<ScatterOffset>( S0 + k0 * ( mu0 * mu0.transpose() ) ) ),
+      log_gamma_ratios_( log_gamma_ratio_table(v0, data.view_.cols(), data.view_.rows()) )
 {
 }
 
+std::shared_ptr<const ScatterOffset> MultivariateNormal::get_scatter_offset() const
+{
+    return offset_;
+}
+
 // Ref. https://www.cs.ubc.ca/~murphyk/Papers/bayesGauss.pdf page 21: Marginal likelihood
-double MultivariateNormal::compute_marginal_log_likelihood(const std::set<std::size_t>& members) const
+double MultivariateNormal::compute_marginal_log_likelihood(const SufficientStatistics& stats) const
 {
-    NIWHyperParam hpost = get_posterior_hyperparameters(members);
+    const double num_data = static_cast<double>( stats.n_ );
+    const double k_post = phyper_.k_ + num_data;
+    const double v_post = phyper_.v_ + num_data;
 
-    double marginal_ll = - ( static_cast<double>(members.size() * data_dimension()) / 2.0) * std::log( boost::math::constants::pi<double>() );
-    marginal_ll += multivariate_log_gamma_ratio(hpost.v_/2.0, phyper_.v_/2.0, data_dimension() );
-    marginal_ll += (phyper_.v_ / 2.0) * std::log( phyper_.S_.determinant() ) - (hpost.v_ / 2.0) * std::log( hpost.S_.determinant() );
-    marginal_ll += (static_cast<double>( data_dimension() ) / 2.0) * ( std::log(phyper_.k_) - std::log(hpost.k_)  );
+    double marginal_ll = - ( num_data * static_cast<double>( data_dimension() ) / 2.0) * std::log( boost::math::constants::pi<double>() );
+    marginal_ll += (stats.n_ < log_gamma_ratios_.size()) ? log_gamma_ratios_[stats.n_]
+                                                         : multivariate_log_gamma_ratio(v_post/2.0, phyper_.v_/2.0, data_dimension() );
+    marginal_ll += (phyper_.v_ / 2.0) * prior_log_det_ - (v_post / 2.0) * posterior_log_determinant(stats);
+    marginal_ll += (static_cast<double>( data_dimension() ) / 2.0) * ( std::log(phyper_.k_) - std::log(k_post)  );
 
     return marginal_ll;
 }
 
-NIWHyperParam MultivariateNormal::get_posterior_hyperparameters(const std::set<std::size_t>& members) const
+double MultivariateNormal::posterior_log_determinant(const SufficientStatistics& stats) const
+{
+    if (stats.offset_ == offset_)
+    {
+        // The posterior scale matrix is (S0 + k0 * mu0 * mu0^T + scatter) - u * u^T / k_post
+        // with u = k0 * mu0 + sum. The table keeps the factor of the first term up to date,
+        // so the matrix determinant lemma gives the log-determinant in O(d^2).
+        const Eigen::VectorXd u = phyper_.k_ * phyper_.mu_ + stats.sum_;
+        const double k_post = phyper_.k_ + static_cast<double>( stats.n_ );
+        const double r = 1.0 - stats.factor_.matrixL().solve(u).squaredNorm() / k_post;
+        if (r > 0.0)
+            return stats.factor_log_determinant() + std::log(r);
+    }
+
+    NIWHyperParam hpost = get_posterior_hyperparameters(stats);
+    return log_determinant( Eigen::LLT<Eigen::MatrixXd>(hpost.S_) );
+}
+
+NIWHyperParam MultivariateNormal::get_posterior_hyperparameters(const SufficientStatistics& stats) const
 {
     // Murphy: Machine learning - a probabilistic perspective
     // Sect. 4.6.3.3
-    const double num_data = static_cast<double>( members.size() );
-    NIWHyperParam hpost(phyper_);
-    hpost.mu_ = ( phyper_.k_ / ( phyper_.k_ + num_data ) ) * phyper_.mu_ + (num_data / ( phyper_.k_ + num_data ) ) * sample_mean(members);
-    hpost.k_ += num_data;
-    hpost.v_ += num_data;
-    hpost.S_ += sample_uncentered_sum_of_squares_matrix(members) + phyper_.k_ * ( phyper_.mu_ * phyper_.mu_.transpose() ) - hpost.k_ * ( hpost.mu_ * hpost.mu_.transpose() );
+    // built from the posterior values directly instead of copying the prior first
+    const double num_data = static_cast<double>( stats.n_ );
+    const double k_post = phyper_.k_ + num_data;
+    const Eigen::VectorXd mu_post = ( phyper_.k_ * phyper_.mu_ + stats.sum_ ) / k_post;
+    return NIWHyperParam(mu_post,
+                         phyper_.S_ + stats.scatter_ + phyper_.k_ * ( phyper_.mu_ * phyper_.mu_.transpose() ) - k_post * ( mu_post * mu_post.transpose() ),
+                         k_post,
+                         phyper_.v_ + num_data);
+}
 
-    return hpost;
+double MultivariateNormal::log_determinant(const Eigen::LLT<Eigen::MatrixXd>& llt)
+{
+    return 2.0 * llt.matrixLLT().diagonal().array().log().sum();
 }
 
 double MultivariateNormal::multivariate_log_gamma_ratio(double a, double b, std::size_t d)
@@ -62,3 +96,11 @@ double MultivariateNormal::multivariate_log_gamma_ratio(double a, double b, std:
 
     return y;
 }
+
+std::vector<double> MultivariateNormal::log_gamma_ratio_table(double v0, std::size_t d, std::size_t max_n)
+{
+    std::vector<double> ratios(max_n + 1);
+    for (std::size_t n = 0; n <= max_n; ++n)
+        ratios[n] = multivariate_log_gamma_ratio( (v0 + static_cast<double>(n)) / 2.0, v0 / 2.0, d );
+    return ratios;
+}
@@ -0,0 +1,219 @@
+#include "PosteriorSummary.h"
+#include "SampleTrace.h"
+#include "Snapshot.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <stdexcept>
+
+PosteriorSummary::PosteriorSummary(const std::shared_ptr<const SparseLogDecay>& log_decay,
+                                   std::size_t max_candidates)
+    : log_decay_(log_decay),
+      pair_source_(),
+      pair_position_(),
+      co_assignments_(),
+      num_samples_(0),
+      log_joint_(),
+      samples_per_chain_(),
+      map_labels_(),
+      map_log_joint_(-std::numeric_limits<double>::infinity()),
+      max_candidates_( std::max<std::size_t>(max_candidates, 2) ),
+      candidate_stride_(1),
+      candidates_(),
+      point_estimate_(0),
+      point_estimate_valid_(false)
+{
+    // keep each pair once: as i < j, or as i > j if there is no link from j to i
+    for (std::size_t i = 0; i < log_decay_->num_customers(); ++i)
+    {
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+        {
+            const std::size_t j = log_decay_->target(k);
+            if ((i < j) || ((j < i) && std::isinf( (*log_decay_)(j, i) )))
+            {
+                pair_source_.push_back(i);
+                pair_position_.push_back(k);
+            }
+        }
+    }
+    co_assignments_.assign(pair_position_.size(), 0);
+}
+
+void PosteriorSummary::add(std::size_t chain, const std::vector<std::size_t>& labels, double log_joint)
+{
+    for (std::size_t p = 0; p < pair_position_.size(); ++p)
+        co_assignments_[p] += (labels[pair_source_[p]] == labels[ log_decay_->target(pair_position_[p]) ]);
+
+    if (samples_per_chain_.size() <= chain)
+        samples_per_chain_.resize(chain + 1, 0);
+    TracePoint t = { chain, samples_per_chain_[chain]++, log_joint };
+    log_joint_.push_back(t);
+
+    if (log_joint > map_log_joint_)
+    {
+        map_log_joint_ = log_joint;
+        map_labels_ = labels;
+    }
+
+    if (num_samples_ % candidate_stride_ == 0)
+    {
+        if (candidates_.size() == max_candidates_)
+        {
+            // keep every other candidate, i.e. every 2 * stride-th sample
+            for (std::size_t c = 0; 2 * c < candidates_.size(); ++c)
+                candidates_[c].swap( candidates_[2 * c] );
+            candidates_.resize( (candidates_.size() + 1) / 2 );
+            candidate_stride_ *= 2;
+        }
+        if (num_samples_ % candidate_stride_ == 0)
+            candidates_.push_back(labels);
+    }
+    ++num_samples_;
+    point_estimate_valid_ = false;
+}
+
+std::size_t PosteriorSummary::num_samples() const
+{
+    return num_samples_;
+}
+
+std::size_t PosteriorSummary::num_pairs() const
+{
+    return pair_position_.size();
+}
+
+void PosteriorSummary::get_pair(std::size_t pair, std::size_t& i, std::size_t& j) const
+{
+    i = pair_source_[pair];
+    j = log_decay_->target(pair_position_[pair]);
+}
+
+std::vector<double> PosteriorSummary::co_clustering_probabilities() const
+{
+    std::vector<double> p(co_assignments_.size(), 0.0);
+    for (std::size_t k = 0; (k < p.size()) && (num_samples_ > 0); ++k)
+        p[k] = static_cast<double>(co_assignments_[k]) / static_cast<double>(num_samples_);
+    return p;
+}
+
+const std::vector<std::size_t>& PosteriorSummary::map_labels() const
+{
+    return map_labels_;
+}
+
+double PosteriorSummary::map_log_joint() const
+{
+    return map_log_joint_;
+}
+
+double PosteriorSummary::expected_binder_loss(const std::vector<std::size_t>& labels) const
+{
+    // a pair costs 1 - p if it is put together and p if it is put apart
+    const std::vector<double> p = co_clustering_probabilities();
+    double loss = 0.0;
+    for (std::size_t k = 0; k < p.size(); ++k)
+    {
+        const bool together = (labels[pair_source_[k]] == labels[ log_decay_->target(pair_position_[k]) ]);
+        loss += together ? (1.0 - p[k]) : p[k];
+    }
+    return loss;
+}
+
+const std::vector<std::size_t>& PosteriorSummary::point_estimate_labels() const
+{
+    if (candidates_.empty())
+        throw std::logic_error("PosteriorSummary: no samples");
+    if (!point_estimate_valid_)
+    {
+        double best = std::numeric_limits<double>::infinity();
+        for (std::size_t c = 0; c < candidates_.size(); ++c)
+        {
+            const double loss = expected_binder_loss(candidates_[c]);
+            if (loss < best)
+            {
+                best = loss;
+                point_estimate_ = c;
+            }
+        }
+        point_estimate_valid_ = true;
+    }
+    return candidates_[point_estimate_];
+}
+
+void PosteriorSummary::write(const std::string& prefix) const
+{
+    std::ofstream co_file(prefix + "coclustering.csv");
+    const std::vector<double> p = co_clustering_probabilities();
+    co_file << std::setprecision(std::numeric_limits<double>::max_digits10);
+    for (std::size_t k = 0; k < p.size(); ++k)
+    {
+        std::size_t i, j;
+        get_pair(k, i, j);
+        co_file << std::min(i, j) << "," << std::max(i, j) << "," << p[k] << "\n";
+    }
+
+    std::ofstream log_joint_file(prefix + "log_joint.csv");
+    log_joint_file << std::setprecision(std::numeric_limits<double>::max_digits10);
+    for (std::size_t s = 0; s < log_joint_.size(); ++s)
+        log_joint_file << log_joint_[s].chain << "," << log_joint_[s].sample << "," << log_joint_[s].log_joint << "\n";
+
+    if (num_samples_ > 0)
+    {
+        std::ofstream map_file(prefix + "map_clustering.csv");
+        print_labels_as_tables(map_labels_, map_file);
+        std::ofstream point_file(prefix + "point_estimate_clustering.csv");
+        print_labels_as_tables(point_estimate_labels(), point_file);
+    }
+
+    if (!co_file || !log_joint_file)
+        throw std::runtime_error("Cannot write posterior summaries with prefix " + prefix);
+}
+
+void PosteriorSummary::save(SnapshotWriter& snapshot) const
+{
+    snapshot.write_uint64( num_pairs() );
+    snapshot.write_uint64(max_candidates_);
+    snapshot.write_sizes(co_assignments_);
+    snapshot.write_uint64(num_samples_);
+    snapshot.write_uint64( log_joint_.size() );
+    for (const auto& t : log_joint_)
+    {
+        snapshot.write_uint64(t.chain);
+        snapshot.write_uint64(t.sample);
+        snapshot.write_double(t.log_joint);
+    }
+    snapshot.write_sizes(samples_per_chain_);
+    snapshot.write_sizes(map_labels_);
+    snapshot.write_double(map_log_joint_);
+    snapshot.write_uint64(candidate_stride_);
+    snapshot.write_uint64( candidates_.size() );
+    for (const auto& c : candidates_)
+        snapshot.write_sizes(c);
+}
+
+void PosteriorSummary::load(SnapshotReader& snapshot)
+{
+    snapshot.expect_uint64(num_pairs(), "number of customer pairs");
+    snapshot.expect_uint64(max_candidates_, "number of point estimate candidates");
+    snapshot.read_sizes(co_assignments_);
+    num_samples_ = snapshot.read_uint64();
+    log_joint_.resize( snapshot.read_uint64() );
+    for (auto& t : log_joint_)
+    {
+        t.chain = snapshot.read_uint64();
+        t.sample = snapshot.read_uint64();
+        t.log_joint = snapshot.read_double();
+    }
+    snapshot.read_sizes(samples_per_chain_);
+    snapshot.read_sizes(map_labels_);
+    map_log_joint_ = snapshot.read_double();
+    candidate_stride_ = snapshot.read_uint64();
+    candidates_.resize( snapshot.read_uint64() );
+    for (auto& c : candidates_)
+        snapshot.read_sizes(c);
+    if ( (co_assignments_.size() != num_pairs()) || (candidates_.size() > max_candidates_) || (candidate_stride_ == 0) )
+        throw std::runtime_error("Malformed snapshot of the posterior summary");
+    point_estimate_valid_ = false;
+}
@@ -0,0 +1,79 @@
+#include "PriorLinkSampler.h"
+#include <boost/random/uniform_int_distribution.hpp>
+#include <boost/random/uniform_real_distribution.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+PriorLinkSampler::PriorLinkSampler(const std::shared_ptr<const SparseLogDecay>& log_decay)
+    : log_decay_(log_decay),
+      keep_(log_decay->num_links(), 1.0),
+      alias_(log_decay->num_links(), 0)
+{
+    // Vose's method: links with less than the average probability are topped up
+    // by one link with more, which then gives away the difference
+    std::vector<double> p;
+    std::vector<std::size_t> small, large;
+    for (std::size_t i = 0; i < log_decay_->num_customers(); ++i)
+    {
+        const std::size_t begin = log_decay_->row_begin(i);
+        const std::size_t end = log_decay_->row_end(i);
+        if (begin == end)
+            continue;
+
+        double m = -std::numeric_limits<double>::infinity();
+        for (std::size_t k = begin; k < end; ++k)
+            m = std::max(m, log_decay_->log_decay(k));
+        p.resize(end - begin);
+        double sum = 0.0;
+        for (std::size_t k = begin; k < end; ++k)
+        {
+            p[k - begin] = std::exp(log_decay_->log_decay(k) - m);
+            sum += p[k - begin];
+        }
+        if ( !(sum >= 1.0) || std::isinf(sum) )
+            throw std::invalid_argument("The log decay values of customer " + std::to_string(i) + " are not finite numbers");
+
+        small.clear();
+        large.clear();
+        for (std::size_t k = begin; k < end; ++k)
+        {
+            alias_[k] = log_decay_->target(k);
+            p[k - begin] *= (end - begin) / sum;
+            if (p[k - begin] < 1.0)
+                small.push_back(k);
+            else
+                large.push_back(k);
+        }
+        while ( !small.empty() && !large.empty() )
+        {
+            const std::size_t s = small.back();
+            const std::size_t l = large.back();
+            small.pop_back();
+            keep_[s] = p[s - begin];
+            alias_[s] = log_decay_->target(l);
+            p[l - begin] -= 1.0 - p[s - begin];
+            if (p[l - begin] < 1.0)
+            {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // whatever is left has probability 1 up to round-off and keeps its own target
+    }
+}
+
+std::size_t PriorLinkSampler::draw(std::size_t source, boost::random::mt19937& rng) const
+{
+    const std::size_t begin = log_decay_->row_begin(source);
+    const std::size_t end = log_decay_->row_end(source);
+    if (begin == end)
+        return source;
+
+    const std::size_t k = boost::random::uniform_int_distribution<std::size_t>(begin, end - 1)(rng);
+    if ( boost::random::uniform_real_distribution<double>(0.0, 1.0)(rng) < keep_[k] )
+        return log_decay_->target(k);
+    return alias_[k];
+}
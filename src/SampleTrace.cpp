@@ -0,0 +1,301 @@
+#include "SampleTrace.h"
+#include "Snapshot.h"
+#include <zlib.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+const char trace_magic[] = "DDCRPTR1";
+const std::size_t trace_magic_size = 8;
+const std::uint64_t full_record = 0;
+const std::uint64_t delta_record = 1;
+// far more chains than any run has; a larger number means a corrupt header
+const std::uint64_t max_trace_chains = 1 << 20;
+
+void append_varint(std::string& out, std::uint64_t x)
+{
+    while (x >= 0x80)
+    {
+        out.push_back(static_cast<char>((x & 0x7f) | 0x80));
+        x >>= 7;
+    }
+    out.push_back(static_cast<char>(x));
+}
+
+}
+
+SampleTraceWriter::SampleTraceWriter(const std::string& file,
+                                     std::size_t num_customers,
+                                     std::size_t num_chains,
+                                     bool compress,
+                                     bool delta)
+    : file_(NULL),
+      num_customers_(num_customers),
+      compress_(compress),
+      delta_(delta),
+      previous_(num_chains),
+      record_()
+{
+    // "T" writes without compression through the same interface
+    open(file, compress_ ? "wb6" : "wbT");
+
+    std::string header(trace_magic, trace_magic_size);
+    append_varint(header, num_customers_);
+    append_varint(header, num_chains);
+    flush(header);
+}
+
+SampleTraceWriter::SampleTraceWriter(const std::string& file, SnapshotReader& snapshot)
+    : file_(NULL),
+      num_customers_(0),
+      compress_(false),
+      delta_(false),
+      previous_(),
+      record_()
+{
+    const std::uint64_t offset = snapshot.read_uint64();
+    num_customers_ = snapshot.read_uint64();
+    compress_ = snapshot.read_bool();
+    delta_ = snapshot.read_bool();
+    previous_.resize( snapshot.read_uint64() );
+    for (auto& p : previous_)
+        snapshot.read_sizes(p);
+
+    // a new gzip stream is appended after the ones written before the snapshot
+    if (::truncate(file.c_str(), static_cast<off_t>(offset)) != 0)
+        throw std::runtime_error("Cannot truncate " + file + " to resume the sample trace");
+    open(file, compress_ ? "ab6" : "abT");
+}
+
+SampleTraceWriter::~SampleTraceWriter()
+{
+    close();
+}
+
+void SampleTraceWriter::open(const std::string& file, const char* mode)
+{
+    gzFile f = gzopen(file.c_str(), mode);
+    if (!f)
+        throw std::runtime_error("Cannot open " + file);
+    gzbuffer(f, 1 << 17);
+    file_ = f;
+}
+
+void SampleTraceWriter::save(SnapshotWriter& snapshot)
+{
+    gzFile f = static_cast<gzFile>(file_);
+    if (gzflush(f, Z_FINISH) != Z_OK)
+        throw std::runtime_error("Cannot write sample trace");
+    snapshot.write_uint64( gzoffset(f) );
+    snapshot.write_uint64(num_customers_);
+    snapshot.write_bool(compress_);
+    snapshot.write_bool(delta_);
+    snapshot.write_uint64( previous_.size() );
+    for (const auto& p : previous_)
+        snapshot.write_sizes(p);
+}
+
+void SampleTraceWriter::write(std::size_t chain, std::size_t sample, const std::vector<std::size_t>& labels)
+{
+    std::vector<std::size_t>& previous = previous_[chain];
+    record_.clear();
+    append_varint(record_, chain);
+    append_varint(record_, sample);
+
+    std::size_t changes = 0;
+    if (delta_ && !previous.empty())
+    {
+        for (std::size_t i = 0; i < num_customers_; ++i)
+            changes += (labels[i] != previous[i]);
+    }
+
+    if (delta_ && !previous.empty() && (2 * changes < num_customers_))
+    {
+        append_varint(record_, delta_record);
+        append_varint(record_, changes);
+        std::size_t next = 0; // first customer after the previous change
+        for (std::size_t i = 0; i < num_customers_; ++i)
+        {
+            if (labels[i] != previous[i])
+            {
+                append_varint(record_, i - next);
+                append_varint(record_, labels[i]);
+                next = i + 1;
+            }
+        }
+    }
+    else
+    {
+        append_varint(record_, full_record);
+        for (std::size_t i = 0; i < num_customers_; ++i)
+            append_varint(record_, labels[i]);
+    }
+    flush(record_);
+    previous = labels;
+}
+
+void SampleTraceWriter::close()
+{
+    if (file_)
+    {
+        gzclose( static_cast<gzFile>(file_) );
+        file_ = NULL;
+    }
+}
+
+void SampleTraceWriter::flush(const std::string& bytes)
+{
+    if (gzwrite(static_cast<gzFile>(file_), bytes.data(), bytes.size()) != static_cast<int>(bytes.size()))
+        throw std::runtime_error("Cannot write sample trace");
+}
+
+SampleTraceReader::SampleTraceReader(const std::string& file)
+    : file_(NULL),
+      path_(file),
+      num_customers_(0),
+      num_chains_(0),
+      previous_()
+{
+    // reads compressed and uncompressed traces alike
+    gzFile f = gzopen(file.c_str(), "rb");
+    if (!f)
+        throw std::runtime_error("Cannot open " + file);
+    gzbuffer(f, 1 << 17);
+    file_ = f;
+
+    char magic[trace_magic_size];
+    if ((gzread(f, magic, trace_magic_size) != static_cast<int>(trace_magic_size)) ||
+        (std::memcmp(magic, trace_magic, trace_magic_size) != 0))
+    {
+        gzclose(f);
+        file_ = NULL;
+        throw std::runtime_error(file + ": not a sample trace");
+    }
+    try
+    {
+        num_customers_ = expect_varint();
+        num_chains_ = expect_varint();
+        if (num_chains_ > max_trace_chains)
+            throw std::runtime_error(file + ": implausible number of chains");
+    }
+    catch (...)
+    {
+        gzclose(f);
+        file_ = NULL;
+        throw;
+    }
+    previous_.resize(num_chains_);
+}
+
+SampleTraceReader::~SampleTraceReader()
+{
+    if (file_)
+        gzclose( static_cast<gzFile>(file_) );
+}
+
+std::size_t SampleTraceReader::num_customers() const
+{
+    return num_customers_;
+}
+
+std::size_t SampleTraceReader::num_chains() const
+{
+    return num_chains_;
+}
+
+bool SampleTraceReader::read(std::size_t& chain, std::size_t& sample, std::vector<std::size_t>& labels)
+{
+    std::uint64_t c;
+    if (!read_varint(c))
+        return false;
+    if (c >= num_chains_)
+        throw std::runtime_error(path_ + ": chain index out of range");
+    chain = c;
+    sample = expect_varint();
+
+    std::vector<std::size_t>& previous = previous_[chain];
+    const std::uint64_t type = expect_varint();
+    if (type == full_record)
+    {
+        previous.resize(num_customers_);
+        for (std::size_t i = 0; i < num_customers_; ++i)
+            previous[i] = expect_label();
+    }
+    else if ((type == delta_record) && !previous.empty())
+    {
+        const std::uint64_t changes = expect_varint();
+        std::size_t next = 0;
+        for (std::uint64_t k = 0; k < changes; ++k)
+        {
+            const std::size_t i = next + expect_varint();
+            if (i >= num_customers_)
+                throw std::runtime_error(path_ + ": customer index out of range");
+            previous[i] = expect_label();
+            next = i + 1;
+        }
+    }
+    else
+        throw std::runtime_error(path_ + ": malformed sample record");
+
+    labels = previous;
+    return true;
+}
+
+bool SampleTraceReader::read_varint(std::uint64_t& x)
+{
+    gzFile f = static_cast<gzFile>(file_);
+    x = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        const int b = gzgetc(f);
+        if (b < 0)
+        {
+            if (shift > 0)
+                throw std::runtime_error(path_ + ": truncated sample trace");
+            return false;
+        }
+        x |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    throw std::runtime_error(path_ + ": malformed varint");
+}
+
+std::uint64_t SampleTraceReader::expect_varint()
+{
+    std::uint64_t x;
+    if (!read_varint(x))
+        throw std::runtime_error(path_ + ": truncated sample trace");
+    return x;
+}
+
+std::size_t SampleTraceReader::expect_label()
+{
+    // labels are customers, and index the tables when the samples are printed
+    const std::uint64_t label = expect_varint();
+    if (label >= num_customers_)
+        throw std::runtime_error(path_ + ": label out of range");
+    return label;
+}
+
+void print_labels_as_tables(const std::vector<std::size_t>& labels, std::ostream& os)
+{
+    std::vector< std::vector<std::size_t> > tables(labels.size());
+    for (std::size_t i = 0; i < labels.size(); ++i)
+        tables[labels[i]].push_back(i);
+    for (std::size_t t = 0; t < tables.size(); ++t)
+    {
+        if (tables[t].empty())
+            continue;
+        for (std::size_t i = 0; i < tables[t].size(); ++i)
+        {
+            if (i > 0)
+                os << ", ";
+            os << tables[t][i];
+        }
+        os << "\n";
+    }
+}
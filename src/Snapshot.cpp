@@ -0,0 +1,135 @@
+#include "Snapshot.h"
+#include <stdexcept>
+
+SnapshotWriter::SnapshotWriter(std::ostream& os)
+    : os_(os)
+{
+}
+
+void SnapshotWriter::write_uint64(std::uint64_t x)
+{
+    write_bytes(&x, sizeof(x));
+}
+
+void SnapshotWriter::write_double(double x)
+{
+    write_bytes(&x, sizeof(x));
+}
+
+void SnapshotWriter::write_bool(bool x)
+{
+    write_uint64(x ? 1 : 0);
+}
+
+void SnapshotWriter::write_string(const std::string& s)
+{
+    write_uint64(s.size());
+    write_bytes(s.data(), s.size());
+}
+
+void SnapshotWriter::write_sizes(const std::vector<std::size_t>& v)
+{
+    write_uint64(v.size());
+    for (const auto& x : v)
+        write_uint64(x);
+}
+
+void SnapshotWriter::write_doubles(const std::vector<double>& v)
+{
+    write_uint64(v.size());
+    write_bytes(v.data(), v.size() * sizeof(double));
+}
+
+void SnapshotWriter::write_matrix(const Eigen::MatrixXd& m)
+{
+    write_uint64(m.rows());
+    write_uint64(m.cols());
+    write_bytes(m.data(), m.size() * sizeof(double));
+}
+
+void SnapshotWriter::write_bytes(const void* p, std::size_t size)
+{
+    if ( !os_.write(static_cast<const char*>(p), size) )
+        throw std::runtime_error("Cannot write snapshot");
+}
+
+SnapshotReader::SnapshotReader(std::istream& is)
+    : is_(is)
+{
+}
+
+std::uint64_t SnapshotReader::read_uint64()
+{
+    std::uint64_t x = 0;
+    read_bytes(&x, sizeof(x));
+    return x;
+}
+
+double SnapshotReader::read_double()
+{
+    double x = 0.0;
+    read_bytes(&x, sizeof(x));
+    return x;
+}
+
+bool SnapshotReader::read_bool()
+{
+    const std::uint64_t x = read_uint64();
+    if (x > 1)
+        throw std::runtime_error("Malformed snapshot");
+    return x == 1;
+}
+
+std::string SnapshotReader::read_string()
+{
+    std::string s( read_count(1), '\0' );
+    read_bytes(&s[0], s.size());
+    return s;
+}
+
+void SnapshotReader::read_sizes(std::vector<std::size_t>& v)
+{
+    v.resize( read_count(sizeof(std::uint64_t)) );
+    for (auto& x : v)
+        x = read_uint64();
+}
+
+void SnapshotReader::read_doubles(std::vector<double>& v)
+{
+    v.resize( read_count(sizeof(double)) );
+    read_bytes(v.data(), v.size() * sizeof(double));
+}
+
+void SnapshotReader::read_matrix(Eigen::MatrixXd& m)
+{
+    const std::uint64_t rows = read_uint64();
+    const std::uint64_t cols = read_uint64();
+    // at most 2^32 elements
+    if ( (cols > 0) && (rows > (static_cast<std::uint64_t>(1) << 32) / cols) )
+        throw std::runtime_error("Malformed snapshot");
+    m.resize(rows, cols);
+    read_bytes(m.data(), m.size() * sizeof(double));
+}
+
+void SnapshotReader::expect_uint64(std::uint64_t expected, const std::string& what)
+{
+    const std::uint64_t x = read_uint64();
+    if (x != expected)
+        throw std::runtime_error("Snapshot does not match the current run: " + what + " is "
+                                 + std::to_string(x) + ", expected " + std::to_string(expected));
+}
+
+void SnapshotReader::read_bytes(void* p, std::size_t size)
+{
+    if ( !is_.read(static_cast<char*>(p), size) )
+        throw std::runtime_error("Truncated snapshot");
+}
+
+std::size_t SnapshotReader::read_count(std::size_t element_size)
+{
+    // guard allocations against corrupt counts: at most 2^40 bytes
+    const std::uint64_t n = read_uint64();
+    if (n > (static_cast<std::uint64_t>(1) << 40) / element_size)
+        throw std::runtime_error("Malformed snapshot");
+    return static_cast<std::size_t>(n);
+}
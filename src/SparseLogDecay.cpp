@@ -0,0 +1,197 @@
+#include "SparseLogDecay.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+SparseLogDecay::SparseLogDecay()
+    : storage_(),
+      owner_(),
+      num_customers_(0),
+      num_links_(0),
+      row_offsets_(NULL),
+      targets_(NULL),
+      log_decay_(NULL)
+{
+    std::shared_ptr<Storage> s = std::make_shared<Storage>();
+    s->row_offsets.push_back(0);
+    attach(s);
+}
+
+SparseLogDecay::SparseLogDecay(const Eigen::Ref<const Eigen::MatrixXd>& log_decay_values)
+    : SparseLogDecay()
+{
+    Storage& s = *storage_;
+    s.row_offsets.reserve(log_decay_values.rows() + 1);
+    for (Eigen::Index i = 0; i < log_decay_values.rows(); ++i)
+    {
+        for (Eigen::Index j = 0; j < log_decay_values.cols(); ++j)
+        {
+            if (!std::isinf(log_decay_values(i, j)))
+            {
+                s.targets.push_back(j);
+                s.log_decay.push_back(log_decay_values(i, j));
+            }
+        }
+        s.row_offsets.push_back(s.targets.size());
+    }
+    attach(storage_);
+}
+
+SparseLogDecay::SparseLogDecay(std::size_t num_customers, std::vector<Triplet> triplets)
+    : SparseLogDecay()
+{
+    triplets.erase( std::remove_if(triplets.begin(), triplets.end(), [](const Triplet& t){ return std::isinf(t.log_decay); }),
+                    triplets.end() );
+    std::sort(triplets.begin(), triplets.end(), [](const Triplet& a, const Triplet& b)
+    {
+        return (a.source < b.source) || ((a.source == b.source) && (a.target < b.target));
+    });
+
+    Storage& s = *storage_;
+    s.row_offsets.assign(num_customers + 1, 0);
+    s.targets.reserve(triplets.size());
+    s.log_decay.reserve(triplets.size());
+    for (std::size_t i = 0; i < triplets.size(); ++i)
+    {
+        const Triplet& t = triplets[i];
+        if ((t.source >= num_customers) || (t.target >= num_customers))
+            throw std::out_of_range("SparseLogDecay: link index exceeds number of customers");
+        if ((i > 0) && (t.source == triplets[i-1].source) && (t.target == triplets[i-1].target))
+            throw std::invalid_argument("SparseLogDecay: duplicate link");
+        s.targets.push_back(t.target);
+        s.log_decay.push_back(t.log_decay);
+        ++s.row_offsets[t.source + 1];
+    }
+    for (std::size_t i = 0; i < num_customers; ++i)
+        s.row_offsets[i + 1] += s.row_offsets[i];
+    attach(storage_);
+}
+
+SparseLogDecay::SparseLogDecay(std::size_t num_customers,
+                               std::size_t num_links,
+                               const std::size_t* row_offsets,
+                               const std::size_t* targets,
+                               const double* log_decay,
+                               const std::shared_ptr<const void>& owner)
+    : storage_(),
+      owner_(owner),
+      num_customers_(num_customers),
+      num_links_(num_links),
+      row_offsets_(row_offsets),
+      targets_(targets),
+      log_decay_(log_decay)
+{
+    if ((row_offsets_[0] != 0) || (row_offsets_[num_customers_] != num_links_))
+        throw std::invalid_argument("SparseLogDecay: row offsets do not match number of links");
+    for (std::size_t i = 0; i < num_customers_; ++i)
+    {
+        if (row_offsets_[i] > row_offsets_[i + 1])
+            throw std::invalid_argument("SparseLogDecay: row offsets are not increasing");
+    }
+    for (std::size_t i = 0; i < num_customers_; ++i)
+    {
+        for (std::size_t k = row_offsets_[i]; k < row_offsets_[i + 1]; ++k)
+        {
+            if (targets_[k] >= num_customers_)
+                throw std::out_of_range("SparseLogDecay: link index exceeds number of customers");
+            // links are looked up by binary search within a row
+            if ((k > row_offsets_[i]) && (targets_[k] <= targets_[k - 1]))
+                throw std::invalid_argument("SparseLogDecay: targets of a row are not strictly increasing");
+            // -Inf marks an impossible link, which is not stored but does no harm
+            if (std::isnan(log_decay_[k]) || (log_decay_[k] == std::numeric_limits<double>::infinity()))
+                throw std::invalid_argument("SparseLogDecay: log decay of a link is NaN or +Inf");
+        }
+    }
+}
+
+void SparseLogDecay::add_row(const std::vector<std::size_t>& targets, const std::vector<double>& log_decay)
+{
+    // copy on write if the arrays are shared with other copies or viewed from elsewhere
+    if (!storage_ || (storage_.use_count() > 1))
+    {
+        std::shared_ptr<Storage> s = std::make_shared<Storage>();
+        s->row_offsets.assign(row_offsets_, row_offsets_ + num_customers_ + 1);
+        s->targets.assign(targets_, targets_ + num_links_);
+        s->log_decay.assign(log_decay_, log_decay_ + num_links_);
+        owner_.reset();
+        storage_ = s;
+    }
+
+    Storage& s = *storage_;
+    for (std::size_t k = 0; k < targets.size(); ++k)
+    {
+        if (!std::isinf(log_decay[k]))
+        {
+            s.targets.push_back(targets[k]);
+            s.log_decay.push_back(log_decay[k]);
+        }
+    }
+    s.row_offsets.push_back(s.targets.size());
+    attach(storage_);
+}
+
+void SparseLogDecay::attach(const std::shared_ptr<Storage>& storage)
+{
+    storage_ = storage;
+    num_customers_ = storage_->row_offsets.size() - 1;
+    num_links_ = storage_->targets.size();
+    row_offsets_ = storage_->row_offsets.data();
+    targets_ = storage_->targets.data();
+    log_decay_ = storage_->log_decay.data();
+}
+
+std::size_t SparseLogDecay::num_customers() const
+{
+    return num_customers_;
+}
+
+std::size_t SparseLogDecay::num_links() const
+{
+    return num_links_;
+}
+
+std::size_t SparseLogDecay::row_begin(std::size_t source) const
+{
+    return row_offsets_[source];
+}
+
+std::size_t SparseLogDecay::row_end(std::size_t source) const
+{
+    return row_offsets_[source + 1];
+}
+
+std::size_t SparseLogDecay::target(std::size_t position) const
+{
+    return targets_[position];
+}
+
+double SparseLogDecay::log_decay(std::size_t position) const
+{
+    return log_decay_[position];
+}
+
+double SparseLogDecay::operator()(std::size_t source, std::size_t target) const
+{
+    const std::size_t* first = targets_ + row_offsets_[source];
+    const std::size_t* last = targets_ + row_offsets_[source + 1];
+    const std::size_t* it = std::lower_bound(first, last, target);
+    if ((it == last) || (*it != target))
+        return -std::numeric_limits<double>::infinity();
+    return log_decay_[it - targets_];
+}
+
+const std::size_t* SparseLogDecay::row_offsets_data() const
+{
+    return row_offsets_;
+}
+
+const std::size_t* SparseLogDecay::targets_data() const
+{
+    return targets_;
+}
+
+const double* SparseLogDecay::log_decay_data() const
+{
+    return log_decay_;
+}
@@ -0,0 +1,156 @@
+#include "SufficientStatistics.h"
+#include "Snapshot.h"
+#include <stdexcept>
+
+void CholeskyFactor::restore(const Eigen::MatrixXd& llt)
+{
+    m_matrix = llt;
+    const Eigen::MatrixXd l = llt.triangularView<Eigen::Lower>();
+    m_l1_norm = ( l * l.transpose() ).cwiseAbs().colwise().sum().maxCoeff();
+    m_isInitialized = true;
+    m_info = Eigen::Success;
+}
+
+SufficientStatistics::SufficientStatistics(int dimension,
+                                           const std::shared_ptr<const ScatterOffset>& offset,
+                                           bool diagonal)
+    : n_(0),
+      fingerprint_(0),
+      sum_(Eigen::VectorXd::Zero(dimension)),
+      scatter_(Eigen::MatrixXd::Zero(dimension, diagonal ? 1 : dimension)),
+      offset_(offset),
+      factor_(),
+      diagonal_(diagonal)
+{
+    if (diagonal_ && offset_)
+        throw std::invalid_argument("SufficientStatistics: diagonal statistics have no Cholesky factor");
+    if (offset_)
+        factor_ = offset_->factor_;
+}
+
+void SufficientStatistics::add(std::size_t customer, const DataPoint& x)
+{
+    ++n_;
+    fingerprint_ ^= customer_key(customer);
+    sum_ += x.transpose();
+    if (diagonal_)
+        scatter_.col(0) += x.transpose().cwiseAbs2();
+    else
+        scatter_.noalias() += x.transpose() * x;
+    if (offset_)
+        factor_.rankUpdate(x.transpose(), 1.0);
+}
+
+void SufficientStatistics::remove(std::size_t customer, const DataPoint& x)
+{
+    --n_;
+    fingerprint_ ^= customer_key(customer);
+    sum_ -= x.transpose();
+    if (diagonal_)
+        scatter_.col(0) -= x.transpose().cwiseAbs2();
+    else
+        scatter_.noalias() -= x.transpose() * x;
+    if (offset_)
+    {
+        factor_.rankUpdate(x.transpose(), -1.0);
+        // a downdate can fail through round-off, start over from the scatter matrix then
+        if (factor_.info() != Eigen::Success)
+            refactorize();
+    }
+}
+
+SufficientStatistics& SufficientStatistics::operator+=(const SufficientStatistics& other)
+{
+    n_ += other.n_;
+    fingerprint_ ^= other.fingerprint_;
+    sum_ += other.sum_;
+    scatter_ += other.scatter_;
+    if (offset_)
+        refactorize();
+    return *this;
+}
+
+SufficientStatistics& SufficientStatistics::operator-=(const SufficientStatistics& other)
+{
+    n_ -= other.n_;
+    fingerprint_ ^= other.fingerprint_;
+    sum_ -= other.sum_;
+    scatter_ -= other.scatter_;
+    if (offset_)
+        refactorize();
+    return *this;
+}
+
+int SufficientStatistics::dimension() const
+{
+    return sum_.size();
+}
+
+bool SufficientStatistics::has_factor() const
+{
+    return static_cast<bool>(offset_);
+}
+
+bool SufficientStatistics::is_diagonal() const
+{
+    return diagonal_;
+}
+
+bool SufficientStatistics::prefers_rank_updates(std::size_t num_points) const
+{
+    // a rank-1 update and the scatter update cost a few d^2 each, a factorization d^3/3
+    return has_factor() && ( 8 * num_points < static_cast<std::size_t>( dimension() ) );
+}
+
+double SufficientStatistics::factor_log_determinant() const
+{
+    return 2.0 * factor_.matrixLLT().diagonal().array().log().sum();
+}
+
+void SufficientStatistics::save(SnapshotWriter& snapshot) const
+{
+    snapshot.write_uint64(n_);
+    snapshot.write_uint64(fingerprint_);
+    snapshot.write_matrix(sum_);
+    snapshot.write_matrix(scatter_);
+    snapshot.write_bool(has_factor());
+    if (has_factor())
+        snapshot.write_matrix(factor_.matrixLLT());
+}
+
+void SufficientStatistics::load(SnapshotReader& snapshot)
+{
+    n_ = snapshot.read_uint64();
+    fingerprint_ = snapshot.read_uint64();
+    Eigen::MatrixXd sum, scatter;
+    snapshot.read_matrix(sum);
+    snapshot.read_matrix(scatter);
+    if ( (sum.rows() != sum_.rows()) || (sum.cols() != 1) ||
+         (scatter.rows() != scatter_.rows()) || (scatter.cols() != scatter_.cols()) ||
+         (snapshot.read_bool() != has_factor()) )
+        throw std::runtime_error("Snapshot does not match the current run: table statistics differ");
+    sum_ = sum;
+    scatter_ = scatter;
+    if (has_factor())
+    {
+        Eigen::MatrixXd llt;
+        snapshot.read_matrix(llt);
+        if ( (llt.rows() != dimension()) || (llt.cols() != dimension()) )
+            throw std::runtime_error("Snapshot does not match the current run: table statistics differ");
+        factor_.restore(llt);
+    }
+}
+
+std::uint64_t SufficientStatistics::customer_key(std::size_t customer)
+{
+    // splitmix64 finalizer
+    std::uint64_t z = static_cast<std::uint64_t>(customer) + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void SufficientStatistics::refactorize()
+{
+    factor_.compute(offset_->matrix_ + scatter_);
+}
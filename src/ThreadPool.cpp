@@ -0,0 +1,48 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t num_threads)
+    : workers_(),
+      tasks_(),
+      mutex_(),
+      cv_(),
+      stop_(false)
+{
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t i = 0; i < num_threads; ++i)
+        workers_.push_back( std::thread(&ThreadPool::work, this) );
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto& w : workers_)
+        w.join();
+}
+
+std::size_t ThreadPool::num_threads() const
+{
+    return workers_.size();
+}
+
+void ThreadPool::work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this](){ return stop_ || !tasks_.empty(); });
+            if (stop_ && tasks_.empty())
+                return;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
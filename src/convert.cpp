@@ -0,0 +1,69 @@
+#include "MatrixIO.h"
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <stdexcept>
+
+// Convert csv inputs of the sampler to binary files that are memory-mapped
+// instead of parsed: data matrices to .npy, log decay values to the binary
+// sparse format.
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+            ("help", "produce help message")
+            ("input,i", po::value<std::string>(), "input csv file")
+            ("output,o", po::value<std::string>(), "output file")
+            ("log-decay", po::bool_switch()->default_value(false), "input is a dense log decay matrix, written in binary sparse format")
+            ("log-decay-triplets", po::bool_switch()->default_value(false), "input lists possible links as source,target,log decay, written in binary sparse format")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || (argc == 1))
+    {
+        std::cout << "Without --log-decay or --log-decay-triplets, the input is written as a float64 .npy matrix.\n";
+        std::cout << desc << "\n";
+        return 1;
+    }
+
+    if (!vm.count("input") || !vm.count("output"))
+    {
+        std::cout << "Input and output files must be set!\n";
+        return 1;
+    }
+    const std::string in_file = vm["input"].as<std::string>();
+    const std::string out_file = vm["output"].as<std::string>();
+
+    try
+    {
+        if (vm["log-decay"].as<bool>() || vm["log-decay-triplets"].as<bool>())
+        {
+            SparseLogDecay log_decay;
+            if (vm["log-decay-triplets"].as<bool>())
+                log_decay = utils::load_csv_log_decay_triplets(in_file);
+            else if (!utils::load_log_decay(in_file, log_decay))
+            {
+                std::cout << "Log decay matrix must be square!\n";
+                return 1;
+            }
+            utils::save_log_decay(out_file, log_decay);
+            std::cout << "Wrote " << log_decay.num_links() << " possible links for " << log_decay.num_customers() << " customers to " << out_file << "\n";
+        }
+        else
+        {
+            const DataMatrix m = utils::load_data_matrix(in_file);
+            utils::save_npy(out_file, m.view_);
+            std::cout << "Wrote " << m.view_.rows() << " by " << m.view_.cols() << " matrix to " << out_file << "\n";
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
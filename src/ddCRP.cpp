@@ -1,72 +1,555 @@
 #include "ddCRP.h"
-#include <boost/random/discrete_distribution.hpp>
+#include "Snapshot.h"
+#include <boost/random/uniform_real_distribution.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 #include <vector>
 #include <iostream>
 
-ddCRP::ddCRP(const Eigen::MatrixXd &log_decay_values, unsigned int seed)
+ddCRP::ddCRP(const Eigen::Ref<const Eigen::MatrixXd>& log_decay_values, unsigned int seed)
     : c_(log_decay_values.rows()),
-      log_decay_values_(log_decay_values),
+      log_decay_( std::make_shared<const SparseLogDecay>(log_decay_values) ),
+      log_normalizers_(),
+      table_position_(),
+      scratch_(),
+      metrics_(),
+      sweep_pool_(),
+      sweep_order_(),
+      batch_scratch_(),
+      batch_(),
+      deferred_(),
+      next_deferred_(),
+      claimed_(),
+      claim_stamp_(0),
+      prior_(),
+      prior_links_(),
       likelihood_(NULL),
+      pool_(),
       rng_( seed )
 {
+    compute_log_normalizers();
+}
+
+ddCRP::ddCRP(const SparseLogDecay& log_decay, unsigned int seed)
+    : c_(log_decay.num_customers()),
+      log_decay_( std::make_shared<const SparseLogDecay>(log_decay) ),
+      log_normalizers_(),
+      table_position_(),
+      scratch_(),
+      metrics_(),
+      sweep_pool_(),
+      sweep_order_(),
+      batch_scratch_(),
+      batch_(),
+      deferred_(),
+      next_deferred_(),
+      claimed_(),
+      claim_stamp_(0),
+      prior_(),
+      prior_links_(),
+      likelihood_(NULL),
+      pool_(),
+      rng_( seed )
+{
+    compute_log_normalizers();
+}
+
+ddCRP::ddCRP(const std::shared_ptr<const SparseLogDecay>& log_decay, unsigned int seed)
+    : c_(log_decay->num_customers()),
+      log_decay_(log_decay),
+      log_normalizers_(),
+      table_position_(),
+      scratch_(),
+      metrics_(),
+      sweep_pool_(),
+      sweep_order_(),
+      batch_scratch_(),
+      batch_(),
+      deferred_(),
+      next_deferred_(),
+      claimed_(),
+      claim_stamp_(0),
+      prior_(),
+      prior_links_(),
+      likelihood_(NULL),
+      pool_(),
+      rng_( seed )
+{
+    compute_log_normalizers();
+}
+
+ddCRP::ddCRP(const DataView& coordinates, const DecayFunction& decay, double self_log_decay, unsigned int seed)
+    : c_(coordinates.rows()),
+      log_decay_( std::make_shared<const SparseLogDecay>( compute_log_decay(coordinates, decay, self_log_decay) ) ),
+      log_normalizers_(),
+      table_position_(),
+      scratch_(),
+      metrics_(),
+      sweep_pool_(),
+      sweep_order_(),
+      batch_scratch_(),
+      batch_(),
+      deferred_(),
+      next_deferred_(),
+      claimed_(),
+      claim_stamp_(0),
+      prior_(),
+      prior_links_(),
+      likelihood_(NULL),
+      pool_(),
+      rng_( seed )
+{
+    compute_log_normalizers();
 }
 
 void ddCRP::setLikelihood(const std::shared_ptr<LikelihoodFcn> &l)
 {
     likelihood_ = l;
+    track_statistics(c_);
+}
+
+void ddCRP::track_statistics(CustomerAssignment& c) const
+{
+    if (likelihood_ && !prior_)
+        c.track_statistics(likelihood_->data(), likelihood_->get_scatter_offset(), likelihood_->uses_diagonal_statistics());
+}
+
+void ddCRP::set_thread_pool(const std::shared_ptr<ThreadPool>& pool)
+{
+    pool_ = pool;
+}
+
+void ddCRP::set_sweep_thread_pool(const std::shared_ptr<ThreadPool>& pool)
+{
+    sweep_pool_ = pool;
+    if (sweep_pool_ && sweep_order_.empty())
+        compute_sweep_order();
+}
+
+void ddCRP::set_prior_sampler(const std::shared_ptr<const PriorLinkSampler>& prior)
+{
+    prior_ = prior;
+    // the same links, with or without statistics
+    prior_links_.resize(c_.num_customers());
+    for (std::size_t i = 0; i < c_.num_customers(); ++i)
+        prior_links_[i] = c_.get_link(i);
+    CustomerAssignment c(c_.num_customers());
+    c.assign(prior_links_);
+    track_statistics(c);
+    c_ = c;
 }
 
 void ddCRP::iterate()
 {
-    std::vector<double> p_link(c_.num_customers(), 0.0);
-    for ( std::size_t source = 0; source < c_.num_customers(); ++source)
+    metrics_.clear();
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    const EvaluationMetrics evaluations = likelihood_->get_evaluation_metrics();
+    const LikelihoodCache::Statistics cache = likelihood_->get_cache_statistics();
+
+    if (prior_)
+    {
+        prior_sweep();
+    }
+    else if (sweep_pool_)
     {
+        parallel_sweep();
+    }
+    else
+    {
+        for ( std::size_t source = 0; source < c_.num_customers(); ++source)
+            update(source);
+    }
+
+    const EvaluationMetrics evaluations_after = likelihood_->get_evaluation_metrics();
+    const LikelihoodCache::Statistics cache_after = likelihood_->get_cache_statistics();
+    metrics_.likelihood_evaluations_ = evaluations_after.evaluations_ - evaluations.evaluations_;
+    metrics_.likelihood_seconds_ = evaluations_after.seconds_ - evaluations.seconds_;
+    metrics_.cache_hits_ = cache_after.hits_ - cache.hits_;
+    metrics_.cache_misses_ = cache_after.misses_ - cache.misses_;
+    metrics_.sweep_seconds_ = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+}
+
+void ddCRP::update(std::size_t source)
+{
+    ++metrics_.customer_updates_;
+    {
+        DDCRP_TIME_PHASE(metrics_, UNLINK);
         c_.unlink(source);
-        get_link_likelihoods(source, p_link);
-        std::transform(p_link.begin(), p_link.end(), p_link.begin(), [](double p){return std::exp(p); } );
-        boost::random::discrete_distribution<std::size_t> d(p_link.begin(), p_link.end());
-        c_.link(source, d(rng_));
     }
+
+    score_tables(source, scratch_, pool_.get(), metrics_);
+    const std::size_t target = draw_link(source, scratch_);
+
+    DDCRP_TIME_PHASE(metrics_, LINK);
+    c_.link(source, target);
 }
 
-void ddCRP::get_link_likelihoods(std::size_t source, std::vector<double>& p) const
+void ddCRP::prior_sweep()
 {
-    p.resize(c_.num_customers());
-    for (std::size_t target = 0; target < p.size(); ++target)
+    // links are independent under the prior: draw all of them, then find the tables
+    const std::size_t n = c_.num_customers();
+    metrics_.customer_updates_ += n;
+    prior_links_.resize(n);
     {
-        p[target] = get_link_likelihood(source, target);
+        DDCRP_TIME_PHASE(metrics_, CUSTOMER_DRAW);
+        for (std::size_t i = 0; i < n; ++i)
+            prior_links_[i] = prior_->draw(i, rng_);
     }
+    DDCRP_TIME_PHASE(metrics_, LINK);
+    c_.assign(prior_links_);
 }
 
-double ddCRP::get_link_likelihood(std::size_t source, std::size_t target) const
+void ddCRP::parallel_sweep()
 {
-    double p = log_decay_values_(source, target);
-    if ((source != target) && !std::isinf(p))
+    // Fixed limits, so that the batches and hence the samples do not depend on
+    // the number of threads: customers per batch, and deferred customers after
+    // which a batch stops looking for more
+    const std::size_t max_batch = 256;
+    const std::size_t max_deferred = 32;
+    // Handing a part of a batch to the pool costs about as much as scoring a few
+    // customers, so each task gets at least this many, and batches of fewer than
+    // twice as many are scored on the sampling thread
+    const std::size_t min_task_size = 4;
+    const std::size_t n = c_.num_customers();
+    if (batch_scratch_.size() < max_batch)
+        batch_scratch_.resize(max_batch);
+    if (claimed_.size() < n)
+        claimed_.assign(n, 0);
+    if (table_position_.size() < n)
+        table_position_.assign(n, std::numeric_limits<std::size_t>::max());
+
+    std::size_t next = 0;
+    deferred_.clear();
+    while ( (next < n) || !deferred_.empty() )
     {
-        // If this is NOT a self link and the link is possible, we examine if tables are connected
-        std::size_t k(0), l(0);
-        if (c_.joins_tables(source, target, k, l))
+        // Customers in the sweep order, deferred ones first. A customer joins the
+        // batch if its own table and the tables it can link to are not those of
+        // any customer before it in this batch, joined or deferred. Such updates
+        // neither change each other's tables nor candidates, so doing them in
+        // either order or together gives the same distribution of the result.
+        // Otherwise the customer is deferred, and its tables stay claimed so that
+        // no later customer is updated before it with an update it would see.
+        ++claim_stamp_;
+        batch_.clear();
+        next_deferred_.clear();
+        std::size_t seen = 0; // deferred customers looked at
+        while ( (batch_.size() < max_batch) && (next_deferred_.size() < max_deferred) )
+        {
+            std::size_t source;
+            if (seen < deferred_.size())
+                source = deferred_[seen++];
+            else if (next < n)
+                source = sweep_order_[next++];
+            else
+                break;
+
+            bool conflict = (claimed_[ c_.get_table(source) ] == claim_stamp_);
+            for (std::size_t k = log_decay_->row_begin(source); !conflict && (k < log_decay_->row_end(source)); ++k)
+                conflict = (claimed_[ c_.get_table( log_decay_->target(k) ) ] == claim_stamp_);
+
+            claimed_[ c_.get_table(source) ] = claim_stamp_;
+            for (std::size_t k = log_decay_->row_begin(source); k < log_decay_->row_end(source); ++k)
+                claimed_[ c_.get_table( log_decay_->target(k) ) ] = claim_stamp_;
+            if (conflict)
+                next_deferred_.push_back(source);
+            else
+                batch_.push_back(source);
+        }
+        // deferred customers not looked at keep their place before the others
+        next_deferred_.insert(next_deferred_.end(), deferred_.begin() + seen, deferred_.end());
+        deferred_.swap(next_deferred_);
+        ++metrics_.batches_;
+
+        for (const auto& source : batch_)
         {
-            std::set<std::size_t> table_l = c_.get_table_members(l);
-            p -= likelihood_->get_marginal_log_likelihood(table_l);
+            ++metrics_.customer_updates_;
+            DDCRP_TIME_PHASE(metrics_, UNLINK);
+            c_.unlink(source);
+        }
 
-            std::set<std::size_t> table_k = c_.get_table_members(k);
-            p -= likelihood_->get_marginal_log_likelihood(table_k);
+        // score on the pool, in contiguous parts of the batch. Either way the new
+        // cache entries are held back, so that the cache evolves the same way.
+        const std::size_t num_tasks = std::min(sweep_pool_->num_threads(), batch_.size() / min_task_size);
+        if (num_tasks > 1)
+        {
+            std::vector< std::future<void> > done;
+            for (std::size_t t = 0; t < num_tasks; ++t)
+            {
+                const std::size_t first = batch_.size() * t / num_tasks;
+                const std::size_t last = batch_.size() * (t + 1) / num_tasks;
+                done.push_back( sweep_pool_->submit( [this, first, last]()
+                {
+                    for (std::size_t i = first; i < last; ++i)
+                    {
+                        UpdateScratch& s = batch_scratch_[i];
+                        score_tables(batch_[i], s, NULL, s.metrics_, &s.cache_inserts_);
+                    }
+                }) );
+            }
+            for (auto& d : done)
+                d.get();
+        }
+        else
+        {
+            for (std::size_t i = 0; i < batch_.size(); ++i)
+                score_tables(batch_[i], batch_scratch_[i], NULL, metrics_, &batch_scratch_[i].cache_inserts_);
+        }
 
-            // insert the smaller set to the larger one (less insert calls) and get joint table likelihood.
-            if ( table_l.size() >= table_k.size() )
+        // insert into the cache, draw and link in the order of the batch
+        for (std::size_t i = 0; i < batch_.size(); ++i)
+        {
+            UpdateScratch& s = batch_scratch_[i];
+            likelihood_->insert_held_back(s.cache_inserts_);
+            s.cache_inserts_.clear();
+            const std::size_t target = draw_link(batch_[i], s);
             {
-                table_l.insert(table_k.begin(), table_k.end());
-                p += likelihood_->get_marginal_log_likelihood(table_l);
+                DDCRP_TIME_PHASE(metrics_, LINK);
+                c_.link(batch_[i], target);
             }
-            else
+            for (std::size_t p = 0; p < SweepMetrics::NUM_PHASES; ++p)
+            {
+                metrics_.phase_calls_[p] += s.metrics_.phase_calls_[p];
+                metrics_.phase_seconds_[p] += s.metrics_.phase_seconds_[p];
+            }
+            s.metrics_.clear();
+        }
+    }
+}
+
+void ddCRP::compute_sweep_order()
+{
+    // possible links in either direction, except self links
+    const std::size_t n = c_.num_customers();
+    std::vector<std::size_t> offsets(n + 1, 0);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+        {
+            const std::size_t j = log_decay_->target(k);
+            if (j != i)
             {
-                table_k.insert(table_l.begin(), table_l.end());
-                p += likelihood_->get_marginal_log_likelihood(table_k);
+                ++offsets[i + 1];
+                ++offsets[j + 1];
             }
         }
+    for (std::size_t i = 0; i < n; ++i)
+        offsets[i + 1] += offsets[i];
+    std::vector<std::size_t> neighbors(offsets[n]);
+    std::vector<std::size_t> next(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+        {
+            const std::size_t j = log_decay_->target(k);
+            if (j != i)
+            {
+                neighbors[next[i]++] = j;
+                neighbors[next[j]++] = i;
+            }
+        }
+
+    // greedy colouring: each customer gets the smallest colour none of its neighbors has
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    std::vector<std::size_t> colour(n, none), used;
+    std::size_t num_colours = 0;
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        for (std::size_t k = offsets[i]; k < offsets[i + 1]; ++k)
+        {
+            const std::size_t c = colour[ neighbors[k] ];
+            if (c == none)
+                continue;
+            if (c >= used.size())
+                used.resize(c + 1, none);
+            used[c] = i;
+        }
+        std::size_t c = 0;
+        while ( (c < used.size()) && (used[c] == i) )
+            ++c;
+        colour[i] = c;
+        num_colours = std::max(num_colours, c + 1);
+    }
+
+    // customers by colour, in customer order within a colour
+    std::vector<std::size_t> start(num_colours + 1, 0);
+    for (std::size_t i = 0; i < n; ++i)
+        ++start[ colour[i] + 1 ];
+    for (std::size_t c = 0; c < num_colours; ++c)
+        start[c + 1] += start[c];
+    sweep_order_.resize(n);
+    for (std::size_t i = 0; i < n; ++i)
+        sweep_order_[ start[ colour[i] ]++ ] = i;
+}
+
+const SweepMetrics& ddCRP::get_metrics() const
+{
+    return metrics_;
+}
+
+void ddCRP::score_tables(std::size_t source, UpdateScratch& s, ThreadPool* pool, SweepMetrics& metrics,
+                         LikelihoodFcn::CacheInserts* held_back) const
+{
+    // sum the decay function values of all possible links into each table,
+    // visiting only the tables reachable from the decay row,
+    // in log space, relative to the largest log decay of each table
+    std::vector<std::size_t>& tables = s.tables_;
+    std::vector<double>& p = s.p_table_;
+    {
+        DDCRP_TIME_PHASE(metrics, TABLE_WEIGHTS);
+        const std::size_t none = std::numeric_limits<std::size_t>::max();
+        if (table_position_.size() < c_.num_customers())
+            table_position_.assign(c_.num_customers(), none);
+        const std::size_t begin = log_decay_->row_begin(source);
+        const std::size_t end = log_decay_->row_end(source);
+        tables.clear();
+        p.clear();
+        s.link_table_.resize(end - begin);
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            const std::size_t t = c_.get_table( log_decay_->target(i) );
+            if (table_position_[t] == none)
+            {
+                table_position_[t] = tables.size();
+                tables.push_back(t);
+                p.push_back( -std::numeric_limits<double>::infinity() );
+            }
+            s.link_table_[i - begin] = table_position_[t];
+            p[table_position_[t]] = std::max( p[table_position_[t]], log_decay_->log_decay(i) );
+        }
+        for (std::size_t t : tables)
+            table_position_[t] = none;
+
+        s.table_sums_.assign(tables.size(), 0.0);
+        for (std::size_t i = begin; i < end; ++i)
+            s.table_sums_[s.link_table_[i - begin]] += std::exp( log_decay_->log_decay(i) - p[s.link_table_[i - begin]] );
+        for (std::size_t l = 0; l < tables.size(); ++l)
+            p[l] += std::log( s.table_sums_[l] );
+    }
+
+    // links to other tables join them with the source table: one merge evaluation per table
+    DDCRP_TIME_PHASE(metrics, MERGE_SCORES);
+    const std::size_t k = c_.get_table(source);
+    s.candidates_.clear();
+    s.candidate_stats_.clear();
+    for (std::size_t l = 0; l < tables.size(); ++l)
+    {
+        if ( (tables[l] != k) && !std::isinf(p[l]) )
+        {
+            s.candidates_.push_back(l);
+            s.candidate_stats_.push_back( &c_.get_table_statistics(tables[l]) );
+        }
+    }
+
+    likelihood_->get_merge_log_likelihood_ratios(c_.get_table_statistics(k), c_.table_members(k),
+                                                 s.candidate_stats_, s.ratios_, pool, held_back);
+    for (std::size_t i = 0; i < s.candidates_.size(); ++i)
+        p[s.candidates_[i]] += s.ratios_[i];
+}
+
+std::size_t ddCRP::draw_link(std::size_t source, UpdateScratch& s)
+{
+    // without possible links, the customer keeps the self link it started with
+    if (s.tables_.empty())
+        return source;
+
+    // all links into the same table have the same likelihood term,
+    // so first choose the table and then the customer at that table
+    std::size_t table;
+    {
+        DDCRP_TIME_PHASE(metrics_, TABLE_DRAW);
+        table = draw_from_log_weights(s.p_table_);
+    }
+
+    const std::size_t begin = log_decay_->row_begin(source);
+    {
+        DDCRP_TIME_PHASE(metrics_, CUSTOMER_WEIGHTS);
+        s.p_link_.assign(s.link_table_.size(), -std::numeric_limits<double>::infinity());
+        for (std::size_t i = 0; i < s.p_link_.size(); ++i)
+        {
+            if (s.link_table_[i] == table)
+                s.p_link_[i] = log_decay_->log_decay(begin + i);
+        }
+    }
+
+    DDCRP_TIME_PHASE(metrics_, CUSTOMER_DRAW);
+    return log_decay_->target( begin + draw_from_log_weights(s.p_link_) );
+}
+
+std::size_t ddCRP::draw_from_log_weights(std::vector<double>& log_weights)
+{
+    // shift by the largest weight so that it becomes 1 and nothing overflows,
+    // then invert the cumulative sum at a uniform point; the weights are
+    // exponentiated in place by Eigen's vectorized exp
+    Eigen::Map<Eigen::ArrayXd> w(log_weights.data(), log_weights.size());
+    const double m = w.maxCoeff();
+    w = (w - m).exp();
+    const double total = w.sum();
+    // not a number if a weight is, e.g. from likelihood hyperparameters outside their domain
+    if ( !(total >= 1.0) || std::isinf(total) )
+        throw std::runtime_error("Cannot draw a link: the link weights are not finite numbers");
+
+    double u = boost::random::uniform_real_distribution<double>(0.0, total)(rng_);
+    std::size_t last = 0;
+    for (std::size_t i = 0; i < log_weights.size(); ++i)
+    {
+        if (log_weights[i] > 0.0)
+        {
+            last = i;
+            u -= log_weights[i];
+            if (u < 0.0)
+                return i;
+        }
+    }
+    // u was within round-off of the total
+    return last;
+}
+
+double ddCRP::log_prior() const
+{
+    double l = 0.0;
+    for (std::size_t i = 0; i < c_.num_customers(); ++i)
+    {
+        // without possible links, the self link is certain
+        if (log_decay_->row_begin(i) == log_decay_->row_end(i))
+            continue;
+        l += (*log_decay_)(i, c_.get_link(i)) - log_normalizers_[i];
+    }
+    return l;
+}
+
+double ddCRP::log_likelihood() const
+{
+    if (prior_)
+        return 0.0;
+    double l = 0.0;
+    for (std::size_t t = 0; t < c_.num_tables(); ++t)
+        l += likelihood_->get_marginal_log_likelihood( c_.get_table_statistics(t) );
+    return l;
+}
+
+double ddCRP::log_joint() const
+{
+    return log_prior() + log_likelihood();
+}
+
+void ddCRP::compute_log_normalizers()
+{
+    log_normalizers_.assign(log_decay_->num_customers(), -std::numeric_limits<double>::infinity());
+    for (std::size_t i = 0; i < log_normalizers_.size(); ++i)
+    {
+        double m = -std::numeric_limits<double>::infinity();
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+            m = std::max(m, log_decay_->log_decay(k));
+        if (std::isinf(m))
+            continue;
+
+        double sum = 0.0;
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+            sum += std::exp(log_decay_->log_decay(k) - m);
+        log_normalizers_[i] = m + std::log(sum);
     }
-    return p;
 }
 
 void ddCRP::print_tables(std::ostream& os) const
@@ -74,6 +557,114 @@ void ddCRP::print_tables(std::ostream& os) const
     c_.print_tables(os);
 }
 
+void ddCRP::set_links(const std::vector<std::size_t>& links)
+{
+    const std::size_t n = c_.num_customers();
+    if (links.size() != n)
+        throw std::invalid_argument("Expected " + std::to_string(n) + " initial links, got " + std::to_string(links.size()));
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        if ( (links[i] != i) && ((links[i] >= n) || std::isinf( (*log_decay_)(i, links[i]) )) )
+            throw std::invalid_argument("Initial link " + std::to_string(i) + " -> " + std::to_string(links[i]) + " is not a possible link");
+    }
+
+    // link from the initial state and compute the statistics once per table
+    CustomerAssignment c(n);
+    for (std::size_t i = 0; i < n; ++i)
+        c.link(i, links[i]);
+    track_statistics(c);
+    c_ = c;
+}
+
+void ddCRP::set_labels(const std::vector<std::size_t>& labels)
+{
+    const std::size_t n = c_.num_customers();
+    if (labels.size() != n)
+        throw std::invalid_argument("Expected " + std::to_string(n) + " initial labels, got " + std::to_string(labels.size()));
+
+    // possible links into each customer from other customers with the same label
+    std::vector<std::size_t> offsets(n + 1, 0);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+        {
+            const std::size_t j = log_decay_->target(k);
+            if ( (j != i) && (labels[j] == labels[i]) )
+                ++offsets[j + 1];
+        }
+    for (std::size_t i = 0; i < n; ++i)
+        offsets[i + 1] += offsets[i];
+    std::vector<std::size_t> sources(offsets[n]);
+    std::vector<std::size_t> next(offsets.begin(), offsets.end() - 1);
+    for (std::size_t i = 0; i < n; ++i)
+        for (std::size_t k = log_decay_->row_begin(i); k < log_decay_->row_end(i); ++k)
+        {
+            const std::size_t j = log_decay_->target(k);
+            if ( (j != i) && (labels[j] == labels[i]) )
+                sources[next[j]++] = i;
+        }
+
+    // grow a tree from each customer not reached yet: customers that can link
+    // to a tree member join the tree by that link. Trees are grown from the
+    // customers with a possible self link first, so that customers who can
+    // reach one are seated with it instead of rooting a tree that needs a cycle.
+    std::vector<std::size_t> links(n), tree(n, n), roots, queue;
+    for (std::size_t t = 0; t < 2 * n; ++t)
+    {
+        const std::size_t r = t % n;
+        if ( (tree[r] != n) || ((t < n) && std::isinf( (*log_decay_)(r, r) )) )
+            continue;
+        tree[r] = r;
+        links[r] = r;
+        roots.push_back(r);
+        queue.assign(1, r);
+        for (std::size_t q = 0; q < queue.size(); ++q)
+        {
+            const std::size_t u = queue[q];
+            for (std::size_t k = offsets[u]; k < offsets[u + 1]; ++k)
+            {
+                const std::size_t s = sources[k];
+                if (tree[s] != n)
+                    continue;
+                tree[s] = r;
+                links[s] = u;
+                queue.push_back(s);
+            }
+        }
+    }
+
+    // The roots are free to link anywhere. A root that can link into another
+    // tree of its cluster joins the two; otherwise it keeps a self link if that
+    // is possible, or closes a cycle within its own tree.
+    std::vector<std::size_t> parent(n);
+    for (std::size_t i = 0; i < n; ++i)
+        parent[i] = i;
+    for (const auto& r : roots)
+    {
+        std::size_t own = n;
+        for (std::size_t k = log_decay_->row_begin(r); k < log_decay_->row_end(r); ++k)
+        {
+            const std::size_t j = log_decay_->target(k);
+            if ( (j == r) || (labels[j] != labels[r]) )
+                continue;
+            const std::size_t a = CustomerAssignment::find_root(parent, tree[r]);
+            const std::size_t b = CustomerAssignment::find_root(parent, tree[j]);
+            if (a != b)
+            {
+                links[r] = j;
+                parent[a] = b;
+                own = n;
+                break;
+            }
+            if (own == n)
+                own = j;
+        }
+        if ( (own != n) && std::isinf( (*log_decay_)(r, r) ) )
+            links[r] = own;
+    }
+
+    set_links(links);
+}
+
 std::size_t ddCRP::get_table(std::size_t customer) const
 {
     return c_.get_table(customer);
@@ -83,3 +674,83 @@ std::size_t ddCRP::num_tables() const
 {
     return c_.num_tables();
 }
+
+void ddCRP::get_labels(std::vector<std::size_t>& labels) const
+{
+    c_.get_labels(labels);
+}
+
+void ddCRP::get_labels(std::size_t* labels) const
+{
+    c_.get_labels(labels);
+}
+
+void ddCRP::get_links(std::size_t* links) const
+{
+    for (std::size_t i = 0; i < c_.num_customers(); ++i)
+        links[i] = c_.get_link(i);
+}
+
+void ddCRP::save_state(SnapshotWriter& snapshot, bool include_cache) const
+{
+    snapshot.write_uint64( log_decay_->num_customers() );
+    snapshot.write_uint64( log_decay_->num_links() );
+    snapshot.write_uint64( likelihood_ ? likelihood_->data_dimension() : 0 );
+    c_.save(snapshot);
+
+    std::stringstream rng;
+    rng << rng_;
+    snapshot.write_string( rng.str() );
+
+    snapshot.write_bool(include_cache && likelihood_);
+    if (include_cache && likelihood_)
+        likelihood_->save_cache(snapshot);
+}
+
+void ddCRP::load_state(SnapshotReader& snapshot)
+{
+    snapshot.expect_uint64(log_decay_->num_customers(), "number of customers");
+    snapshot.expect_uint64(log_decay_->num_links(), "number of possible links");
+    snapshot.expect_uint64(likelihood_ ? likelihood_->data_dimension() : 0, "data dimension");
+    c_.load(snapshot);
+
+    // the stream state after extraction is not reliable, check by writing the state back
+    const std::string saved_rng = snapshot.read_string();
+    std::stringstream rng(saved_rng);
+    rng >> rng_;
+    std::stringstream restored_rng;
+    restored_rng << rng_;
+    if (restored_rng.str() != saved_rng)
+        throw std::runtime_error("Malformed snapshot of the random number generator");
+
+    if (snapshot.read_bool())
+    {
+        if (!likelihood_)
+            throw std::runtime_error("Snapshot does not match the current run: it has a likelihood cache");
+        likelihood_->load_cache(snapshot);
+    }
+}
+
+std::vector<std::size_t> map_labels(const std::vector<std::size_t>& previous_labels,
+                                    const std::vector<long>& previous)
+{
+    // labels of new customers start after the largest previous label
+    std::size_t next = 0;
+    for (const auto& l : previous_labels)
+        next = std::max(next, l + 1);
+
+    std::vector<std::size_t> labels(previous.size());
+    for (std::size_t i = 0; i < previous.size(); ++i)
+    {
+        if (previous[i] < 0)
+        {
+            labels[i] = next++;
+            continue;
+        }
+        if (static_cast<std::size_t>(previous[i]) >= previous_labels.size())
+            throw std::invalid_argument("Customer " + std::to_string(i) + " maps to " + std::to_string(previous[i]) +
+                                        ", but the previous frame has " + std::to_string(previous_labels.size()) + " customers");
+        labels[i] = previous_labels[ previous[i] ];
+    }
+    return labels;
+}
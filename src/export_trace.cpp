@@ -0,0 +1,61 @@
+#include "SampleTrace.h"
+#include <boost/program_options.hpp>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+// Write the samples of a sample trace as one csv file per sample, named and
+// formatted like the output of the sampler without a trace: one table per line,
+// listing its members. Tables are ordered by their smallest member.
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+            ("help", "produce help message")
+            ("input,i", po::value<std::string>(), "sample trace file")
+            ("output-dir,o", po::value<std::string>()->default_value("."), "directory for the csv files")
+            ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || (argc == 1) || !vm.count("input"))
+    {
+        std::cout << desc << "\n";
+        return 1;
+    }
+
+    try
+    {
+        SampleTraceReader trace(vm["input"].as<std::string>());
+        const std::string dir = vm["output-dir"].as<std::string>();
+
+        std::size_t chain, sample, num_written = 0;
+        std::vector<std::size_t> labels;
+        while (trace.read(chain, sample, labels))
+        {
+            std::stringstream st;
+            st << dir << "/clustering_";
+            if (trace.num_chains() > 1)
+                st << "c" << std::setfill('0') << std::setw(2) << chain << "_";
+            st << std::setfill('0') << std::setw(4) << sample << ".csv";
+            std::ofstream table_file(st.str());
+            print_labels_as_tables(labels, table_file);
+            if (!table_file)
+                throw std::runtime_error("Cannot write " + st.str());
+            ++num_written;
+        }
+        std::cout << "Wrote " << num_written << " samples\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,120 +1,462 @@
 #include "ddCRP.h"
-#include "MultivariateNormal.h"
+#include "FixedDimensionNormal.h"
+#include "DiagonalNormalGamma.h"
 #include "DontcareLikelihood.h"
+#include "HyperparameterGrid.h"
+#include "MultiChainSampler.h"
+#include "MatrixIO.h"
+#include "SampleTrace.h"
+#include "PosteriorSummary.h"
+#include "MetricsWriter.h"
+#include "Snapshot.h"
 #include <eigen3/Eigen/Dense>
 #include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
+#include <limits>
+#include <list>
+#include <mutex>
 
-namespace utils
+namespace
 {
 
-template<typename M, int StorageType = Eigen::RowMajor>
-M load_csv (const std::string& csvfile)
+const char checkpoint_magic[] = "DDCRPCK1";
+const std::size_t checkpoint_magic_size = 8;
+
+volatile std::sig_atomic_t terminate_requested = 0;
+
+void request_termination(int)
 {
-    std::ifstream indata;
-    indata.open(csvfile);
-    std::string line;
-    std::vector<double> values;
-    uint rows = 0;
-    while (std::getline(indata, line)) {
-        std::stringstream lineStream(line);
-        std::string cell;
-        while (std::getline(lineStream, cell, ',')) {
-            values.push_back(std::stod(cell));
+    terminate_requested = 1;
+}
+
+// part of the output file names of a configuration of a hyperparameter grid
+std::string configuration_tag(std::size_t configuration)
+{
+    std::stringstream st;
+    st << "g" << std::setfill('0') << std::setw(2) << configuration << "_";
+    return st.str();
+}
+
+// the number of completed sweeps and everything needed to continue from there,
+// written to a temporary file first so that a checkpoint is never left half written
+void save_checkpoint(const std::string& file,
+                     unsigned int num_sweeps,
+                     const MultiChainSampler& sampler,
+                     bool include_caches,
+                     const std::vector< std::unique_ptr<PosteriorSummary> >& summaries,
+                     const HyperparameterGrid* grid,
+                     SampleTraceWriter* trace)
+{
+    const std::string temporary = file + ".tmp";
+    {
+        std::ofstream os(temporary, std::ios::binary);
+        if (!os)
+            throw std::runtime_error("Cannot open " + temporary);
+        os.write(checkpoint_magic, checkpoint_magic_size);
+        SnapshotWriter snapshot(os);
+        snapshot.write_uint64(num_sweeps);
+        sampler.save(snapshot, include_caches);
+        snapshot.write_bool( !summaries.empty() );
+        for (const auto& summary : summaries)
+            summary->save(snapshot);
+        snapshot.write_bool(trace != NULL);
+        if (trace)
+            trace->save(snapshot);
+        snapshot.write_bool(grid != NULL);
+        if (grid)
+            grid->save(snapshot);
+        os.flush();
+        if (!os)
+            throw std::runtime_error("Cannot write " + temporary);
+    }
+    if (std::rename(temporary.c_str(), file.c_str()) != 0)
+        throw std::runtime_error("Cannot replace " + file);
+}
+
+
+// Inputs loaded once and shared by the jobs of a batch, e.g. the log decay
+// values of images of the same size. At most capacity inputs are kept, least
+// recently used first out; jobs asking for an input that is being loaded wait
+// for it instead of loading it again.
+class InputCache
+{
+public:
+    explicit InputCache(std::size_t capacity)
+        : mutex_(),
+          entries_(),
+          capacity_(capacity)
+    {
+    }
+
+    // the input stored under key, loaded by load() if it is not in the cache
+    template<typename T>
+    std::shared_ptr<const T> get(const std::string& key, const std::function<T()>& load)
+    {
+        Input input;
+        std::promise< std::shared_ptr<const void> > loading;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = find(key);
+            if (it != entries_.end())
+            {
+                entries_.splice(entries_.begin(), entries_, it);
+                input = it->second;
+            }
+            else if (capacity_ > 0)
+            {
+                entries_.push_front( std::make_pair(key, loading.get_future().share()) );
+                if (entries_.size() > capacity_)
+                    entries_.pop_back();
+            }
+        }
+        if (input.valid())
+            return std::static_pointer_cast<const T>( input.get() );
+        if (capacity_ == 0)
+            return std::make_shared<const T>( load() );
+
+        try
+        {
+            std::shared_ptr<const T> value = std::make_shared<const T>( load() );
+            loading.set_value(value);
+            return value;
+        }
+        catch (...)
+        {
+            // let waiting jobs fail too, but retry for later ones
+            loading.set_exception( std::current_exception() );
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = find(key);
+            if (it != entries_.end())
+                entries_.erase(it);
+            throw;
+        }
+    }
+
+private:
+    typedef std::shared_future< std::shared_ptr<const void> > Input;
+    typedef std::list< std::pair<std::string, Input> > Entries;
+
+    Entries::iterator find(const std::string& key)
+    {
+        for (auto it = entries_.begin(); it != entries_.end(); ++it)
+        {
+            if (it->first == key)
+                return it;
         }
-        ++rows;
+        return entries_.end();
     }
-    return Eigen::Map<const Eigen::Matrix<typename M::Scalar, M::RowsAtCompileTime, M::ColsAtCompileTime, StorageType> >(values.data(), rows, values.size()/rows);
+
+    std::mutex mutex_;
+    Entries entries_; // most recently used first
+    std::size_t capacity_;
+};
+
+// resources shared by the jobs of a batch
+struct BatchResources
+{
+    explicit BatchResources(std::size_t num_threads, std::size_t input_cache_capacity)
+        : inputs_(input_cache_capacity),
+          chain_pool_( std::make_shared<ThreadPool>(num_threads) )
+    {
+    }
+
+    InputCache inputs_;
+    std::shared_ptr<ThreadPool> chain_pool_; // runs the chains of all jobs
+};
+
+// input loaded by load(), through the cache of the batch if there is one
+template<typename T>
+std::shared_ptr<const T> load_input(BatchResources* batch, const std::string& key, const std::function<T()>& load)
+{
+    if (batch)
+        return batch->inputs_.get<T>(key, load);
+    return std::make_shared<const T>( load() );
 }
 
+// final state of the first chain of a run, for the batch summary log
+struct RunResult
+{
+    std::size_t num_customers_;
+    std::size_t num_tables_;
+    double log_joint_;
+};
+
+// options that turn the program into a batch runner instead of a single run
+boost::program_options::options_description batch_options(std::string& log_file,
+                                                          std::size_t& num_threads,
+                                                          std::size_t& input_cache_capacity)
+{
+    namespace po = boost::program_options;
+    po::options_description batch("Batch mode");
+    batch.add_options()
+            ("batch", po::value<std::string>(), "run the jobs listed in this manifest file (- for stdin), one command line of the options above per line, instead of a single run; jobs share loaded inputs and the chain threads, but each has its own samplers and likelihood caches")
+            ("batch-threads", po::value<std::size_t>(&num_threads)->default_value(0), "number of jobs run at a time, and of threads running their chains (0: one per hardware thread)")
+            ("batch-log", po::value<std::string>(&log_file)->default_value("batch_log.csv"), "summary log with one line per finished job")
+            ("batch-input-cache", po::value<std::size_t>(&input_cache_capacity)->default_value(16), "number of log decay, prior covariance and prior mean inputs kept loaded for later jobs")
+            ;
+    return batch;
 }
-int main(int argc, char* argv[])
+
+// One complete run with the given command line arguments, writing messages to out.
+// Returns the exit status of the program; result is set after a successful run.
+int run(const std::vector<std::string>& args, std::ostream& out, BatchResources* batch, RunResult& result)
 {
     namespace po = boost::program_options;
 
     po::options_description desc("Allowed options");
-    unsigned int seed, num_samples, num_burn_in_samples;
-    double S, k, v;
+    unsigned int seed, num_samples, num_burn_in_samples, checkpoint_every;
+    std::size_t cache_size, num_chains, num_threads, num_link_threads, num_sweep_threads, report_every, summary_candidates;
+    double S, k, v, max_r_hat, min_ess, decay_a, decay_max, self_log_decay;
     desc.add_options()
             ("help", "produce help message")
-            ("log-decay-file,l", po::value<std::string>(), "csv file containing the log decay function values")
-            ("feature-file,f", po::value<std::string>(), "csv file containing the feature vectors of the data points")
-            ("prior-cov-file,S", po::value<std::string>(), "csv file with prior cluster covariance matrix")
+            ("log-decay-file,l", po::value<std::string>(), "csv, .npy or binary sparse file containing the log decay function values")
+            ("log-decay-triplet-file,L", po::value<std::string>(), "csv file listing possible links as source,target,log decay (alternative to -l)")
+            ("coords-file", po::value<std::string>(), "csv or .npy file with coordinates of the customers, to compute the log decay values from (alternative to -l)")
+            ("decay", po::value<std::string>()->default_value("exponential"), "decay function of coordinate distances: exponential, logistic or window")
+            ("decay-a", po::value<double>(&decay_a)->default_value(0.3), "decay function parameter a (window size of the window decay)")
+            ("decay-max", po::value<double>(&decay_max)->default_value(std::numeric_limits<double>::infinity(), "inf"), "distance beyond which links are impossible, for the exponential and logistic decays")
+            ("self-log-decay", po::value<double>(&self_log_decay)->default_value(-0.8/0.3, "-0.8/0.3"), "log decay of self links with --coords-file")
+            ("feature-file,f", po::value<std::string>(), "csv or .npy file containing the feature vectors of the data points")
+            ("likelihood", po::value<std::string>()->default_value("niw"), "cluster likelihood: niw (full covariance, Normal-inverse-Wishart prior) or diag (diagonal covariance, independent Normal-Gamma prior per dimension)")
+            ("prior-cov-file,S", po::value<std::string>(), "csv or .npy file with prior cluster covariance matrix (with --likelihood diag, its diagonal or a vector of per-dimension scales)")
             ("v", po::value<double>(&v)->default_value(14), "strength of cluster prior covariance")
-            ("prior-mean-file,m", po::value<std::string>(), "csv file with cluster prior mean")
+            ("prior-mean-file,m", po::value<std::string>(), "csv or .npy file with cluster prior mean")
             ("k", po::value<double>(&k)->default_value(0.01), "strength of cluster prior mean")
+            ("grid-k", po::value< std::vector<double> >()->multitoken(), "values of k to sample with: each combination with the values of --grid-v and --grid-scale is sampled by its own --chains chains")
+            ("grid-v", po::value< std::vector<double> >()->multitoken(), "values of v to sample with (see --grid-k)")
+            ("grid-scale", po::value< std::vector<double> >()->multitoken(), "factors of the prior covariance matrix to sample with (see --grid-k)")
+            ("grid-summary-file", po::value<std::string>()->default_value("grid_summary.csv"), "with --grid-k, --grid-v or --grid-scale, results of each configuration are written to this file")
             ("n", po::value<unsigned int>(&num_samples)->default_value(50), "number of samples to draw")
             ("b", po::value<unsigned int>(&num_burn_in_samples)->default_value(50), "number of burn-in samples for MCMC")
             ("seed,s", po::value<unsigned int>(&seed)->default_value(1234567890), "RNG seed")
+            ("init-links", po::value<std::string>(), "csv or .npy file with the initial link target of each customer (zero-based), instead of starting from self links")
+            ("init-labels", po::value<std::string>(), "csv or .npy file with an initial cluster label of each customer; each cluster is seated at one table along possible links")
+            ("init-clustering", po::value<std::string>(), "clustering file as written by the sampler, one table per line, to start from (alternative to --init-labels)")
+            ("init-map", po::value<std::string>(), "csv or .npy file with the index of each customer in the frame of --init-labels or --init-clustering, -1 for new customers")
+            ("cache-size", po::value<std::size_t>(&cache_size)->default_value(LikelihoodCache::default_capacity), "maximum number of cached likelihood values (0 disables the cache)")
+            ("dynamic-dimension", po::bool_switch()->default_value(false), "use the generic likelihood code also for 2 to 8 dimensional features")
             ("draw-from-prior,p", po::bool_switch()->default_value(false), "draw from ddCRP prior (ignore features and likelihood model)")
+            ("chains", po::value<std::size_t>(&num_chains)->default_value(1), "number of independent chains, seeded seed, seed+1, ...")
+            ("threads", po::value<std::size_t>(&num_threads)->default_value(0), "number of threads for running chains (0: one per hardware thread)")
+            ("link-threads", po::value<std::size_t>(&num_link_threads)->default_value(1), "number of threads for scoring candidate links within each customer update (1: no extra threads)")
+            ("sweep-threads", po::value<std::size_t>(&num_sweep_threads)->default_value(1), "number of threads updating customers with non-interacting neighborhoods at the same time within each chain (1: serial sweeps in customer order); experimental and often slower than serial sweeps, see README")
+            ("report-every", po::value<std::size_t>(&report_every)->default_value(10), "with several chains, report convergence diagnostics every this many samples")
+            ("max-r-hat", po::value<double>(&max_r_hat)->default_value(1.01), "R-hat threshold of the convergence diagnostics")
+            ("min-ess", po::value<double>(&min_ess)->default_value(400), "effective sample size threshold of the convergence diagnostics")
+            ("stop-early", po::bool_switch()->default_value(false), "with several chains, stop sampling once the diagnostics pass")
+            ("trace", po::value<std::string>(), "write all samples to this sample trace file instead of one csv file per sample")
+            ("trace-compress", po::bool_switch()->default_value(false), "compress the sample trace with zlib")
+            ("summarize", po::bool_switch()->default_value(false), "accumulate posterior summaries over all samples and chains: co-clustering probabilities, log joint trace, MAP clustering and Binder point estimate")
+            ("summary-prefix", po::value<std::string>()->default_value(""), "prefix of the posterior summary files")
+            ("summary-candidates", po::value<std::size_t>(&summary_candidates)->default_value(100), "maximum number of samples kept as candidates for the point estimate")
+            ("no-samples", po::bool_switch()->default_value(false), "do not write the individual samples")
+            ("metrics-file", po::value<std::string>(), "write counters and timers of every sweep of every chain to this file")
+            ("metrics-format", po::value<std::string>()->default_value("json"), "format of the metrics file: json (one line per sweep and chain, appended) or prometheus (latest values, replaced every sweep)")
+            ("checkpoint", po::value<std::string>(), "save the complete sampler state to this file periodically and on SIGTERM")
+            ("checkpoint-every", po::value<unsigned int>(&checkpoint_every)->default_value(100), "sweeps between checkpoints (0: only on SIGTERM)")
+            ("checkpoint-cache", po::bool_switch()->default_value(false), "include the likelihood caches in checkpoints")
+            ("resume", po::bool_switch()->default_value(false), "continue from the checkpoint file if it exists, with the same inputs and options")
+            ("output-prefix", po::value<std::string>()->default_value(""), "prefix of the clustering files of the samples, e.g. a directory of this job in a batch")
             ("wordy,w", po::bool_switch()->default_value(false), "toggle verbose mode with extra output")
             ;
+    std::string batch_log;
+    std::size_t batch_threads, batch_input_cache;
+    desc.add( batch_options(batch_log, batch_threads, batch_input_cache) );
 
     po::variables_map vm;
-    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::store(po::command_line_parser(args).options(desc).run(), vm);
     po::notify(vm);
 
-    if (vm.count("help") || (argc == 1))
+    if (vm.count("help") || args.empty())
     {
-        std::cout << desc << "\n";
+        out << desc << "\n";
+        return 1;
+    }
+    if (vm.count("batch"))
+    {
+        out << "Batch jobs cannot run batches!\n";
         return 1;
     }
 
-    Eigen::MatrixXd log_decay;
-    if (vm.count("log-decay-file"))
+    // log decay values and priors may be shared with other jobs of a batch
+    std::shared_ptr<const SparseLogDecay> log_decay_values;
+    if (vm.count("log-decay-file") + vm.count("log-decay-triplet-file") + vm.count("coords-file") > 1)
+    {
+        out << "Only one of log decay file, log decay triplet file and coordinate file can be set!\n";
+        return 1;
+    }
+    else if (vm.count("log-decay-file"))
     {
         std::string d_file = vm["log-decay-file"].as<std::string>();
         if ( vm["wordy"].as<bool>() )
-            std::cout << "Loading log decay file " << d_file << "\n";
-        log_decay = utils::load_csv<Eigen::MatrixXd>(d_file);
-        if ( log_decay.rows() != log_decay.cols())
+            out << "Loading log decay file " << d_file << "\n";
+        try
+        {
+            log_decay_values = load_input<SparseLogDecay>(batch, "log-decay-file " + d_file, [&d_file]()
+            {
+                SparseLogDecay log_decay;
+                if ( !utils::load_log_decay(d_file, log_decay) )
+                    throw std::runtime_error("Log decay matrix must be square!");
+                return log_decay;
+            });
+        }
+        catch (const std::runtime_error& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
+    }
+    else if (vm.count("log-decay-triplet-file"))
+    {
+        std::string d_file = vm["log-decay-triplet-file"].as<std::string>();
+        if ( vm["wordy"].as<bool>() )
+            out << "Loading log decay triplet file " << d_file << "\n";
+        try
+        {
+            log_decay_values = load_input<SparseLogDecay>(batch, "log-decay-triplet-file " + d_file, [&d_file]()
+            {
+                return utils::load_csv_log_decay_triplets(d_file);
+            });
+        }
+        catch (const std::exception& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
+    }
+    else if (vm.count("coords-file"))
+    {
+        std::string c_file = vm["coords-file"].as<std::string>();
+        if ( vm["wordy"].as<bool>() )
+            out << "Loading coordinate file " << c_file << "\n";
+        try
+        {
+            std::shared_ptr<const DecayFunction> decay = DecayFunction::create(vm["decay"].as<std::string>(), decay_a, decay_max);
+            std::stringstream key;
+            key << std::setprecision(17) << "coords-file " << c_file << " " << vm["decay"].as<std::string>() << " "
+                << decay_a << " " << decay_max << " " << self_log_decay;
+            log_decay_values = load_input<SparseLogDecay>(batch, key.str(), [&]()
+            {
+                const DataMatrix coordinates = utils::load_data_matrix(c_file);
+                return compute_log_decay(coordinates.view_, *decay, self_log_decay);
+            });
+        }
+        catch (const std::exception& e)
         {
-            std::cout << "Log decay matrix number of rows (" << log_decay.rows() << ") must match number of columns (" << log_decay.cols() <<")!\n";
+            out << e.what() << "\n";
             return 1;
         }
     }
     else
     {
-        std::cout << "Log decay file must be set!\n";
+        out << "Log decay file or coordinate file must be set!\n";
         return 1;
     }
+    const SparseLogDecay& log_decay = *log_decay_values;
+
+    if ( vm["wordy"].as<bool>() )
+        out << "Log decay has " << log_decay.num_links() << " possible links for " << log_decay.num_customers() << " customers\n";
 
-    Eigen::MatrixXd features;
+    DataMatrix feature_values = DataMatrix( Eigen::MatrixXd() );
+    const DataView& features = feature_values.view_;
     if (vm.count("feature-file"))
     {
         std::string f_file = vm["feature-file"].as<std::string>();
         if ( vm["wordy"].as<bool>() )
-            std::cout << "Loading feature file " << f_file << "\n";
-        features = utils::load_csv<Eigen::MatrixXd>(f_file);
-        if ( log_decay.rows() != features.rows())
+            out << "Loading feature file " << f_file << "\n";
+        try
+        {
+            feature_values = utils::load_data_matrix(f_file);
+        }
+        catch (const std::runtime_error& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
+        if ( log_decay.num_customers() != static_cast<std::size_t>( features.rows() ))
         {
-            std::cout << "Feature matrix number of rows (" << features.rows() << ") must match number of rows in log decay matrix (" << log_decay.rows() <<")!\n";
+            out << "Feature matrix number of rows (" << features.rows() << ") must match number of rows in log decay matrix (" << log_decay.num_customers() <<")!\n";
             return 1;
         }
     }
     else
     {
-        std::cout << "Feature file must be set!\n";
+        out << "Feature file must be set!\n";
+        return 1;
+    }
+
+    const std::string likelihood_name = vm["likelihood"].as<std::string>();
+    const bool diagonal = (likelihood_name == "diag");
+    if ( !diagonal && (likelihood_name != "niw") )
+    {
+        out << "Unknown likelihood " << likelihood_name << " - expected niw or diag!\n";
+        return 1;
+    }
+
+    // the hyperparameters, or the lists of values of a hyperparameter grid
+    const bool use_grid = (vm.count("grid-k") + vm.count("grid-v") + vm.count("grid-scale") > 0);
+    const std::vector<double> k_values = vm.count("grid-k") ? vm["grid-k"].as< std::vector<double> >() : std::vector<double>(1, k);
+    const std::vector<double> v_values = vm.count("grid-v") ? vm["grid-v"].as< std::vector<double> >() : std::vector<double>(1, v);
+    const std::vector<double> scale_values = vm.count("grid-scale") ? vm["grid-scale"].as< std::vector<double> >() : std::vector<double>(1, 1.0);
+    const double min_k = *std::min_element(k_values.begin(), k_values.end());
+    const double min_v = *std::min_element(v_values.begin(), v_values.end());
+    if ( !(*std::min_element(scale_values.begin(), scale_values.end()) > 0.0) )
+    {
+        out << "Prior covariance scales must be positive!\n";
         return 1;
     }
 
     Eigen::MatrixXd S0;
+    Eigen::VectorXd s0; // per-dimension scales of the diagonal likelihood
     if (vm.count("prior-cov-file"))
     {
         std::string s_file = vm["prior-cov-file"].as<std::string>();
         if ( vm["wordy"].as<bool>() )
-            std::cout << "Loading prior covariance file " << s_file << "\n";
-        S0 = utils::load_csv<Eigen::MatrixXd>(s_file);
-        if ( S0.rows() != S0.cols() || S0.rows() != features.cols() )
+            out << "Loading prior covariance file " << s_file << "\n";
+        try
+        {
+            S0 = *load_input<Eigen::MatrixXd>(batch, "prior-cov-file " + s_file, [&s_file]() { return utils::load_matrix(s_file); });
+        }
+        catch (const std::runtime_error& e)
         {
-            std::cout << "Prior covariance matrix size is " << S0.rows() << " by " << S0.cols() << " - expected square matrix with dimensions matching feature dimensionality " << features.cols() << "!\n";
+            out << e.what() << "\n";
+            return 1;
+        }
+        if ( diagonal && (S0.size() == features.cols()) )
+        {
+            s0 = Eigen::Map<const Eigen::VectorXd>(S0.data(), S0.size());
+        }
+        else if ( S0.rows() != S0.cols() || S0.rows() != features.cols() )
+        {
+            out << "Prior covariance matrix size is " << S0.rows() << " by " << S0.cols() << " - expected square matrix with dimensions matching feature dimensionality " << features.cols() << "!\n";
+            return 1;
+        }
+        else
+        {
+            s0 = S0.diagonal();
+        }
+        if ( diagonal && ( !(s0.array() > 0.0).all() || (min_k <= 0.0) || (min_v <= 0.0) ) )
+        {
+            out << "The per-dimension prior scales, k and v must be positive!\n";
+            return 1;
+        }
+        if ( !diagonal && !vm["draw-from-prior"].as<bool>() && ( (min_k <= 0.0) || (min_v <= features.cols() - 1.0) ) )
+        {
+            out << "k must be positive and v greater than the feature dimension minus one!\n";
             return 1;
         }
     }
     else
     {
-        std::cout << "Prior covariance file must be set!\n";
+        out << "Prior covariance file must be set!\n";
         return 1;
     }
 
@@ -123,60 +465,516 @@ int main(int argc, char* argv[])
     {
         std::string m_file = vm["prior-mean-file"].as<std::string>();
         if ( vm["wordy"].as<bool>() )
-            std::cout << "Loading prior mean file " << m_file << "\n";
-        m0 = utils::load_csv<Eigen::VectorXd, Eigen::ColMajor>(m_file);
+            out << "Loading prior mean file " << m_file << "\n";
+        try
+        {
+            m0 = *load_input<Eigen::VectorXd>(batch, "prior-mean-file " + m_file, [&m_file]() { return utils::load_vector(m_file); });
+        }
+        catch (const std::runtime_error& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
         if ( m0.rows() != features.cols() )
         {
-            std::cout << "Prior mean vector length is " << m0.rows() << " - expected vector with length matching feature dimensionality " << features.cols() << "!\n";
+            out << "Prior mean vector length is " << m0.rows() << " - expected vector with length matching feature dimensionality " << features.cols() << "!\n";
             return 1;
         }
     }
     else
     {
-        std::cout << "Prior mean file must be set!\n";
+        out << "Prior mean file must be set!\n";
         return 1;
     }
 
-    ddCRP clustering(log_decay, seed);
+    if (num_chains == 0)
+    {
+        out << "Number of chains must be positive!\n";
+        return 1;
+    }
 
-    std::shared_ptr<LikelihoodFcn> likelihood;
-    if ( vm["draw-from-prior"].as<bool>() )
+    // one group of chains per combination of the hyperparameter values
+    std::unique_ptr<HyperparameterGrid> grid;
+    if (use_grid)
     {
-        likelihood = std::shared_ptr<LikelihoodFcn> ( new DontcareLikelihood(features, m0, S0, k, v) );
+        if ( vm["stop-early"].as<bool>() )
+        {
+            out << "Stopping early is not available with a hyperparameter grid!\n";
+            return 1;
+        }
+        grid.reset( new HyperparameterGrid(k_values, v_values, scale_values, num_chains) );
+        num_chains = grid->num_chains();
+        if ( vm["wordy"].as<bool>() )
+            out << "Sampling " << grid->num_configurations() << " hyperparameter configurations with "
+                << grid->chains_per_configuration() << " chains each\n";
     }
-    else
+
+    // the chains share the features and the log decay values, but each has its own likelihood cache
+    const bool draw_from_prior = vm["draw-from-prior"].as<bool>();
+    const bool fixed_dimension = !vm["dynamic-dimension"].as<bool>();
+    const DataMatrix& shared_features = feature_values;
+    std::vector< std::shared_ptr<LikelihoodFcn> > likelihoods;
+    auto make_likelihood = [&]()
     {
-        likelihood = std::shared_ptr<LikelihoodFcn> ( new MultivariateNormal(features, m0, S0, k, v) );
+        // chains are created in order, so the next chain is the number created so far
+        double chain_k = k, chain_v = v, scale = 1.0;
+        if (grid)
+        {
+            const HyperparameterGrid::Configuration& h = grid->get_configuration( grid->configuration_of_chain(likelihoods.size()) );
+            chain_k = h.k_;
+            chain_v = h.v_;
+            scale = h.scale_;
+        }
+
+        std::shared_ptr<LikelihoodFcn> likelihood;
+        if ( draw_from_prior )
+        {
+            likelihood = std::shared_ptr<LikelihoodFcn> ( new DontcareLikelihood(shared_features, m0, S0, chain_k, chain_v) );
+        }
+        else if ( diagonal )
+        {
+            const Eigen::VectorXd chain_s0 = scale * s0;
+            likelihood = std::shared_ptr<LikelihoodFcn> ( new DiagonalNormalGamma(shared_features, m0, chain_s0, chain_k, chain_v) );
+        }
+        else
+        {
+            const Eigen::MatrixXd chain_S0 = scale * S0;
+            likelihood = make_normal_likelihood(shared_features, m0, chain_S0, chain_k, chain_v, fixed_dimension);
+        }
+        likelihood->set_cache_capacity(cache_size);
+        likelihoods.push_back(likelihood);
+        return likelihood;
+    };
+
+    // in a batch, the chains of all jobs run on one pool
+    std::unique_ptr<MultiChainSampler> chains( batch ?
+        new MultiChainSampler(log_decay_values, make_likelihood, num_chains, seed, batch->chain_pool_) :
+        new MultiChainSampler(log_decay_values, make_likelihood, num_chains, seed, num_threads) );
+    MultiChainSampler& sampler = *chains;
+    if (num_link_threads > 1)
+        sampler.set_link_thread_pool( std::make_shared<ThreadPool>(num_link_threads) );
+    if (num_sweep_threads > 1)
+        sampler.set_sweep_thread_pool( std::make_shared<ThreadPool>(num_sweep_threads) );
+    // under the prior, all links are drawn directly from alias tables shared by the chains
+    if (draw_from_prior)
+    {
+        try
+        {
+            sampler.set_prior_sampler( std::make_shared<const PriorLinkSampler>(log_decay_values) );
+        }
+        catch (const std::exception& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
     }
 
-    clustering.setLikelihood(likelihood);
+    // warm start, e.g. from a sample of the previous frame
+    if (vm.count("init-links") + vm.count("init-labels") + vm.count("init-clustering") > 1)
+    {
+        out << "Only one of initial links, labels and clustering can be set!\n";
+        return 1;
+    }
+    if ( vm.count("init-map") && !vm.count("init-labels") && !vm.count("init-clustering") )
+    {
+        out << "An index map requires initial labels or an initial clustering!\n";
+        return 1;
+    }
+    try
+    {
+        if (vm.count("init-links"))
+        {
+            const std::vector<long> targets = utils::load_index_vector(vm["init-links"].as<std::string>());
+            if ( std::any_of(targets.begin(), targets.end(), [](long t) { return t < 0; }) )
+                throw std::runtime_error("Initial links must be customer indices");
+            sampler.set_links( std::vector<std::size_t>(targets.begin(), targets.end()) );
+        }
+        else if ( vm.count("init-labels") || vm.count("init-clustering") )
+        {
+            std::vector<std::size_t> initial_labels;
+            if (vm.count("init-labels"))
+            {
+                const std::vector<long> l = utils::load_index_vector(vm["init-labels"].as<std::string>());
+                initial_labels.assign(l.begin(), l.end());
+            }
+            else
+            {
+                initial_labels = utils::load_clustering(vm["init-clustering"].as<std::string>());
+            }
+            if (vm.count("init-map"))
+                initial_labels = map_labels(initial_labels, utils::load_index_vector(vm["init-map"].as<std::string>()));
+            sampler.set_labels(initial_labels);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        out << e.what() << "\n";
+        return 1;
+    }
+    if ( vm["wordy"].as<bool>() && (vm.count("init-links") || vm.count("init-labels") || vm.count("init-clustering")) )
+        out << "Starting from " << sampler.get_chain(0).num_tables() << " tables\n";
 
     if ( vm["wordy"].as<bool>() )
-        std::cout << "Starting sampling!\n";
+        out << "Starting sampling!\n";
+
+    std::unique_ptr<MetricsWriter> metrics;
+    if (vm.count("metrics-file"))
+    {
+        try
+        {
+            metrics.reset( new MetricsWriter(vm["metrics-file"].as<std::string>(),
+                                             MetricsWriter::parse_format(vm["metrics-format"].as<std::string>())) );
+        }
+        catch (const std::exception& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    std::vector<std::size_t> labels;
+    // posterior summaries of each configuration of the grid, or of all chains
+    std::vector< std::unique_ptr<PosteriorSummary> > summaries;
+    for (std::size_t g = 0; vm["summarize"].as<bool>() && (g < (grid ? grid->num_configurations() : 1)); ++g)
+        summaries.push_back( std::unique_ptr<PosteriorSummary>( new PosteriorSummary(log_decay_values, summary_candidates) ) );
+    const bool write_samples = !vm["no-samples"].as<bool>();
+
+    const std::string checkpoint_file = vm.count("checkpoint") ? vm["checkpoint"].as<std::string>() : std::string();
+    if ( vm["resume"].as<bool>() && checkpoint_file.empty() )
+    {
+        out << "Resuming requires a checkpoint file!\n";
+        return 1;
+    }
 
-    for ( unsigned int i = 0; i < num_burn_in_samples + num_samples; ++i)
+    // continue from the checkpoint if there is one, otherwise start from scratch
+    unsigned int first_sweep = 0;
+    std::unique_ptr<SampleTraceWriter> trace;
+    std::ifstream resume_file;
+    if ( vm["resume"].as<bool>() )
+        resume_file.open(checkpoint_file, std::ios::binary);
+    try
     {
-        clustering.iterate();
+        if ( resume_file.is_open() )
+        {
+            char magic[checkpoint_magic_size];
+            if ( !resume_file.read(magic, checkpoint_magic_size) || (std::memcmp(magic, checkpoint_magic, checkpoint_magic_size) != 0) )
+                throw std::runtime_error(checkpoint_file + ": not a checkpoint");
+            SnapshotReader snapshot(resume_file);
+            first_sweep = snapshot.read_uint64();
+            sampler.load(snapshot);
+            if ( snapshot.read_bool() != !summaries.empty() )
+                throw std::runtime_error("Snapshot does not match the current run: --summarize differs");
+            for (auto& summary : summaries)
+                summary->load(snapshot);
+            if ( snapshot.read_bool() != (vm.count("trace") > 0) )
+                throw std::runtime_error("Snapshot does not match the current run: --trace differs");
+            if (vm.count("trace"))
+                trace.reset( new SampleTraceWriter(vm["trace"].as<std::string>(), snapshot) );
+            if ( snapshot.read_bool() != static_cast<bool>(grid) )
+                throw std::runtime_error("Snapshot does not match the current run: hyperparameter grid differs");
+            if (grid)
+                grid->load(snapshot);
+            if ( vm["wordy"].as<bool>() )
+                out << "Resuming from " << checkpoint_file << " after " << first_sweep << " sweeps\n";
+        }
+        else if (vm.count("trace"))
+        {
+            trace.reset( new SampleTraceWriter(vm["trace"].as<std::string>(), log_decay.num_customers(), num_chains,
+                                               vm["trace-compress"].as<bool>()) );
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        out << e.what() << "\n";
+        return 1;
+    }
+    if ( !checkpoint_file.empty() )
+        std::signal(SIGTERM, request_termination);
+
+    for ( unsigned int i = first_sweep; i < num_burn_in_samples + num_samples; ++i)
+    {
+        // checkpoint the state after i sweeps, and stop there if asked to
+        if ( !checkpoint_file.empty() && (i > first_sweep) &&
+             ( terminate_requested || ((checkpoint_every > 0) && (i % checkpoint_every == 0)) ) )
+        {
+            try
+            {
+                save_checkpoint(checkpoint_file, i, sampler, vm["checkpoint-cache"].as<bool>(), summaries, grid.get(), trace.get());
+            }
+            catch (const std::runtime_error& e)
+            {
+                out << e.what() << "\n";
+                return 1;
+            }
+            if (terminate_requested)
+            {
+                out << "Terminated, the state after " << i << " sweeps is saved in " << checkpoint_file << "\n";
+                return 128 + SIGTERM;
+            }
+        }
+
+        sampler.iterate();
+        if (metrics)
+        {
+            for (std::size_t c = 0; c < num_chains; ++c)
+                metrics->write(c, i, sampler.get_chain(c).get_metrics(), sampler.get_chain(c).num_tables(), sampler.get_log_joint(c));
+            metrics->flush();
+        }
         // skip the samples until burn-in is complete
         if ( i < num_burn_in_samples )
         {
             if ( vm["wordy"].as<bool>() )
-                std::cout << "Burn-in-sample #" << i << "\n";
+                out << "Burn-in-sample #" << i << "\n";
             continue;
         }
 
+        const unsigned int sample = i - num_burn_in_samples;
         if ( vm["wordy"].as<bool>() )
-            std::cout << "Sample " << i - num_burn_in_samples << "\n";
+            out << "Sample " << sample << "\n";
 
-        std::stringstream st;
-        st << "clustering_" << std::setfill('0') << std::setw(4) << i - num_burn_in_samples << ".csv";
-        std::ofstream table_file(st.str());
-        if (table_file.is_open())
+        for (std::size_t c = 0; (c < num_chains) && grid; ++c)
         {
-            clustering.print_tables( table_file );
+            const ddCRP& chain = sampler.get_chain(c);
+            grid->add(c, chain.num_tables(), chain.log_likelihood(), sampler.get_log_joint(c));
+        }
+        // chains are numbered within their configuration in the summaries and file names
+        const std::size_t chains_per_group = grid ? grid->chains_per_configuration() : num_chains;
+        for (std::size_t c = 0; (c < num_chains) && (!summaries.empty() || (trace && write_samples)); ++c)
+        {
+            sampler.get_chain(c).get_labels(labels);
+            if (!summaries.empty())
+                summaries[c / chains_per_group]->add(c % chains_per_group, labels, sampler.get_log_joint(c));
+            if (trace && write_samples)
+                trace->write(c, sample, labels);
+        }
+        for (std::size_t c = 0; (c < num_chains) && !trace && write_samples; ++c)
+        {
+            std::stringstream st;
+            st << vm["output-prefix"].as<std::string>() << "clustering_";
+            if (grid)
+                st << configuration_tag( grid->configuration_of_chain(c) );
+            if (chains_per_group > 1)
+                st << "c" << std::setfill('0') << std::setw(2) << c % chains_per_group << "_";
+            st << std::setfill('0') << std::setw(4) << sample << ".csv";
+            std::ofstream table_file(st.str());
+            if (table_file.is_open())
+            {
+                sampler.get_chain(c).print_tables( table_file );
+            }
+            table_file.close();
+        }
+
+        // the diagnostics compare chains of the same model
+        if ( (num_chains > 1) && !grid )
+        {
+            sampler.record();
+            const bool last = (i + 1 == num_burn_in_samples + num_samples);
+            const bool converged = sampler.converged(max_r_hat, min_ess);
+            if ( ((report_every > 0) && ((sample + 1) % report_every == 0)) || last || converged )
+            {
+                const ConvergenceDiagnostics& t = sampler.num_tables_diagnostics();
+                const ConvergenceDiagnostics& j = sampler.log_joint_diagnostics();
+                out << "Sample " << sample << ": number of tables R-hat " << t.r_hat() << " ESS " << t.effective_sample_size()
+                          << ", log joint R-hat " << j.r_hat() << " ESS " << j.effective_sample_size() << "\n";
+            }
+            if ( converged && vm["stop-early"].as<bool>() )
+            {
+                out << "Diagnostics passed after " << sample + 1 << " samples, stopping.\n";
+                break;
+            }
+        }
+    }
+
+    for (std::size_t g = 0; g < summaries.size(); ++g)
+    {
+        const PosteriorSummary& summary = *summaries[g];
+        try
+        {
+            summary.write( vm["summary-prefix"].as<std::string>() + (grid ? configuration_tag(g) : std::string()) );
+        }
+        catch (const std::runtime_error& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
+        if ( vm["wordy"].as<bool>() && (summary.num_samples() > 0) )
+            out << (grid ? "Configuration " + std::to_string(g) + ": " : std::string())
+                << "MAP log joint " << summary.map_log_joint() << ", point estimate expected Binder loss "
+                      << summary.expected_binder_loss( summary.point_estimate_labels() ) << "\n";
+    }
+
+    if (grid)
+    {
+        try
+        {
+            grid->write( vm["grid-summary-file"].as<std::string>() );
+        }
+        catch (const std::runtime_error& e)
+        {
+            out << e.what() << "\n";
+            return 1;
+        }
+        for (std::size_t g = 0; g < grid->num_configurations(); ++g)
+        {
+            const HyperparameterGrid::Configuration& h = grid->get_configuration(g);
+            out << "Configuration " << g << " (k " << h.k_ << ", v " << h.v_ << ", scale " << h.scale_ << "): "
+                << grid->mean_num_tables(g) << " tables and log marginal likelihood " << grid->mean_log_likelihood(g)
+                << " (sd " << grid->sd_log_likelihood(g) << ", max " << grid->max_log_likelihood(g) << ") on average over "
+                << grid->num_samples(g) << " samples\n";
+        }
+    }
+
+    result.num_customers_ = log_decay.num_customers();
+    result.num_tables_ = sampler.get_chain(0).num_tables();
+    result.log_joint_ = sampler.get_chain(0).log_joint();
+
+    if ( vm["wordy"].as<bool>() )
+    {
+        for (std::size_t c = 0; c < likelihoods.size(); ++c)
+        {
+            const LikelihoodCache::Statistics cs = likelihoods[c]->get_cache_statistics();
+            out << "Likelihood cache of chain " << c << ": " << cs.hits_ << " hits, " << cs.misses_ << " misses, "
+                      << cs.evictions_ << " evictions, " << cs.entries_ << " of " << cs.capacity_ << " entries, "
+                      << cs.bytes_ << " bytes\n";
         }
-        table_file.close();
     }
 
     return 0;
 }
+
+// a csv field that may contain commas and quotes
+std::string csv_quote(const std::string& s)
+{
+    std::string q = "\"";
+    for (const auto& c : s)
+    {
+        if (c == '"')
+            q += '"';
+        q += c;
+    }
+    return q + "\"";
+}
+
+// Runs the jobs of a manifest on a pool of worker threads. Each line of the
+// manifest is the command line of one job; empty lines and lines starting with
+// # are skipped. The jobs share one pool for their chains and a cache of loaded
+// inputs; samplers and likelihood caches are per job, so that the samples of a
+// job do not depend on the jobs run before it. The messages of a job are written to stdout when it ends, prefixed by
+// its line number, and a line with its exit status, run time, final state and
+// last message is appended to the summary log. Returns 1 if any job failed.
+int run_batch(const std::string& manifest,
+              const std::string& log_file,
+              std::size_t num_threads,
+              std::size_t input_cache_capacity)
+{
+    std::ifstream manifest_file;
+    if (manifest != "-")
+    {
+        manifest_file.open(manifest);
+        if (!manifest_file)
+        {
+            std::cout << "Cannot open " << manifest << "\n";
+            return 1;
+        }
+    }
+    std::istream& jobs = (manifest == "-") ? std::cin : manifest_file;
+
+    std::ofstream log(log_file);
+    if (!log)
+    {
+        std::cout << "Cannot open " << log_file << "\n";
+        return 1;
+    }
+    log << "job,status,seconds,customers,tables,log_joint,message\n";
+    log.flush();
+
+    BatchResources batch(num_threads, input_cache_capacity);
+    ThreadPool workers(num_threads);
+    std::mutex output_mutex;
+    std::vector< std::future<int> > done;
+    std::string line;
+    for (std::size_t job = 1; std::getline(jobs, line); ++job)
+    {
+        const std::size_t first = line.find_first_not_of(" \t\r");
+        if ( (first == std::string::npos) || (line[first] == '#') )
+            continue;
+
+        done.push_back( workers.submit( [&, job, line]()
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            std::stringstream out;
+            RunResult result = {0, 0, 0.0};
+            int status = 1;
+            try
+            {
+                status = run(boost::program_options::split_unix(line), out, &batch, result);
+            }
+            catch (const std::exception& e)
+            {
+                out << e.what() << "\n";
+            }
+            const double seconds = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::string message, l;
+            while (std::getline(out, l))
+            {
+                std::cout << "[job " << job << "] " << l << "\n";
+                if (!l.empty())
+                    message = l;
+            }
+            std::cout.flush();
+            log << job << "," << status << "," << seconds << ",";
+            if (status == 0)
+            {
+                const std::streamsize precision = log.precision(17);
+                log << result.num_customers_ << "," << result.num_tables_ << "," << result.log_joint_;
+                log.precision(precision);
+            }
+            else
+                log << ",,";
+            log << "," << csv_quote(message) << "\n";
+            log.flush();
+            return status;
+        }) );
+    }
+
+    int status = 0;
+    for (auto& d : done)
+    {
+        if (d.get() != 0)
+            status = 1;
+    }
+    return status;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    namespace po = boost::program_options;
+    const std::vector<std::string> args(argv + 1, argv + argc);
+
+    std::string batch_log;
+    std::size_t batch_threads, batch_input_cache;
+    const po::options_description batch = batch_options(batch_log, batch_threads, batch_input_cache);
+    // no guessing of abbreviations here: they may be meant for the full option set of run()
+    const po::parsed_options parsed = po::command_line_parser(args).options(batch).allow_unregistered()
+        .style(po::command_line_style::default_style & ~po::command_line_style::allow_guessing).run();
+    po::variables_map vm;
+    po::store(parsed, vm);
+    po::notify(vm);
+
+    if (vm.count("batch"))
+    {
+        if ( !po::collect_unrecognized(parsed.options, po::include_positional).empty() )
+        {
+            std::cout << "The options of the jobs of a batch belong in its manifest!\n";
+            return 1;
+        }
+        return run_batch(vm["batch"].as<std::string>(), batch_log, batch_threads, batch_input_cache);
+    }
+
+    RunResult result;
+    return run(args, std::cout, NULL, result);
+}